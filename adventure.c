@@ -78,6 +78,42 @@ typedef struct {
     int          y_speed;        /* number of pixels of y motion per move */
 } game_info_t;
 
+/*
+ * An image of the view at (0,0) of a room, drawn ahead of time by the
+ * pre-render thread and split into planes (see make_view_image).  The
+ * image is current while the room's version is unchanged (see
+ * room_version).  Three images are kept, enough for the rooms to the
+ * left, through the door, and to the right of the player's room.
+ */
+#define N_PRERENDER 3
+typedef struct {
+    const room_t* room;			/* room drawn, or NULL    */
+    uint32_t      version;		/* room version when drawn */
+    unsigned char img[VIEW_IMAGE_SIZE];	/* image split into planes */
+} prerender_t;
+
+/* 
+ * Rows of the room drawn per call to the fill functions when the whole
+ * screen is redrawn, so that world_lock is held only briefly at a time.
+ */
+#define REDRAW_BAND_ROWS 32
+
+/*
+ * A snapshot of what the screen should show, made by the game loop once
+ * per tick and drawn by the render thread.  A snapshot is not changed
+ * once published (see publish_frame).  Rooms entered are counted so that
+ * the render thread notices each entry, even into the room last drawn.
+ */
+typedef struct {
+    const room_t* room;			   /* player's room                */
+    uint32_t      entry;		   /* rooms entered so far         */
+    int32_t       map_x, map_y;		   /* upper left display pixel     */
+    int32_t       n_dirty;		   /* changed parts, or -1 for all */
+    dirty_rect_t  dirty[MAX_DIRTY_RECTS];  /* changed parts of the room    */
+    char          status[STATUS_MSG_LEN + 1]; /* status message          */
+    char          typed[MAX_TYPED_LEN + 1];   /* typed command           */
+} frame_t;
+
 
 /*
  * enumerated values, structure, and static data used for parsing typed
@@ -133,7 +169,13 @@ static const typed_cmd_t cmd_list[] = {
 
 /* local functions--see function headers for details */
 
+static void cancel_prerender_thread (void* ignore);
 static void cancel_status_thread (void* ignore);
+static void draw_frame (const frame_t* f);
+static void fill_horiz_locked (int x, int y, unsigned char buf[SCROLL_X_DIM]);
+static void fill_rect_locked (int x, int y, int w, int h, unsigned char* buf);
+static void fill_vert_locked (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
+static prerender_t* find_prerendered (const room_t* r);
 static game_condition_t game_loop (void);
 static int32_t handle_typing (void);
 static void init_game (void);
@@ -141,8 +183,16 @@ static void move_photo_down (void);
 static void move_photo_left (void);
 static void move_photo_right (void);
 static void move_photo_up (void);
+static void prerender_near (const room_t* r);
+static void* prerender_thread (void* ignore);
+static void publish_frame (frame_t* f);
 static void redraw_room (void);
+static void redraw_changes (const frame_t* f);
+static void* render_thread (void* ignore);
+static void scroll_view (int32_t x, int32_t y);
+static int32_t show_prerendered (const room_t* r);
 static void* status_thread (void* ignore);
+static void stop_render_thread (void* ignore);
 static int time_is_after (struct timeval* t1, struct timeval* t2);
 static void show_tux();
 
@@ -175,6 +225,56 @@ static pthread_t tux_thread_id;
 static pthread_mutex_t controller_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t controller_cv = PTHREAD_COND_INITIALIZER;
 
+/*
+ * The pre-render thread keeps images of the view at (0,0) of the rooms one
+ * move from prerender_from (the room last entered), so that entering one
+ * of them takes only a copy of its image into the build buffer and a
+ * palette upload.  Images that have gone stale (objects moved or photos
+ * swapped) are drawn again.
+ *
+ * The world_lock mutex protects the game world.  It is held while player
+ * commands run (they change the world) and while the photo and objects
+ * of a room are copied for drawing, one band of the screen at a time
+ * (see fill_rect_locked), or a whole room by the pre-render thread.  It
+ * also protects the images, prerender_from, and rooms_entered.  Wake the
+ * pre-render thread with prerender_cv (while holding world_lock) whenever
+ * the world may have changed.
+ */
+static pthread_t prerender_thread_id;
+static pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prerender_cv = PTHREAD_COND_INITIALIZER;
+static const room_t* prerender_from = NULL;
+static prerender_t prerender[N_PRERENDER];
+
+/*
+ * The render thread draws the snapshots published by the game loop, so
+ * that an expensive redraw does not hold up input or game logic (which
+ * wait for world_lock at most while one band of the room is copied).  Two
+ * snapshots are kept: the render thread draws one (frame_drawing) while
+ * the game loop publishes into the other (frame_ready, -1 until a new
+ * snapshot is published).  A snapshot published before the last one was
+ * taken replaces it, keeping its changed parts of the room.  The handoff
+ * and render_stop are protected by frame_lock, and the render thread
+ * waits on frame_cv.  While the render thread runs, no other thread
+ * draws to the screen.
+ *
+ * The render thread also remembers what it last drew: the room entry and
+ * the view window position.  The game loop counts rooms entered; a
+ * snapshot taken before the latest entry is dropped, even part way
+ * through drawing, since only the current room's photos are kept in
+ * memory for drawing.
+ */
+static pthread_t render_thread_id;
+static pthread_mutex_t frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t frame_cv = PTHREAD_COND_INITIALIZER;
+static frame_t frame[2];
+static int32_t frame_ready = -1;
+static int32_t frame_drawing = -1;
+static int32_t render_stop = 0;
+static uint32_t drawn_entry = 0;
+static int32_t drawn_x, drawn_y;
+static uint32_t rooms_entered = 0;
+
 static int32_t enter_room; //player changes room
 static int prev; //keeps track of time in case of reset;
 volatile int terminate = 0; //allows end game
@@ -196,6 +296,21 @@ cancel_status_thread (void* ignore)
     (void)pthread_cancel (status_thread_id);
 }
 
+/*
+ * cancel_prerender_thread
+ *   DESCRIPTION: Terminates the pre-render thread.  Used as a cleanup
+ *                method to ensure proper shutdown.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+cancel_prerender_thread (void* ignore)
+{
+    (void)pthread_cancel (prerender_thread_id);
+}
+
 /*
  * cancel_tux_thread
  *   DESCRIPTION: Terminates the tux helper thread.  Used as
@@ -229,6 +344,7 @@ game_loop ()
     struct timeval start_time, tick_time;
 
     struct timeval cur_time; /* current time (during tick)      */
+    frame_t        snap;     /* what the screen should show     */
     //cmd_t cmd;               /* command issued by input control */
     //int32_t enter_room;      /* player has changed rooms        */
 
@@ -248,35 +364,41 @@ game_loop ()
     /* The main event loop. */
     while (1) {
 	/*
-	 * Update the screen, preparing the VGA palette and photo-drawing
-	 * routines and drawing a new room photo first if the player has
-	 * entered a new room, then showing the screen (and status bar,
-	 * once you have it working).
+	 * Update the screen: take a snapshot of what it should show,
+	 * entering a new room first if the player has moved, and hand the
+	 * snapshot to the render thread, which draws it (and the status
+	 * bar) while we go on.
 	 */
+	(void)pthread_mutex_lock (&world_lock);
 	if (enter_room) {
 	    /* Reset the view window to (0,0). */
 	    game_info.map_x = game_info.map_y = 0;
-	    set_view_window (game_info.map_x, game_info.map_y);
 
 	    /* Discard any partially-typed command. */
 	    reset_typed_command ();
 
-	    /* Adjust colors and photo drawing for the current room photo. */
-	    prep_room (game_info.where);
+	    /* Keep this room's photos in memory; read those nearby. */
+	    room_entered (game_info.where);
+	    rooms_entered++;
 
-	    /* Draw the room (calls show. */
-	    redraw_room ();
-
-	    /* Only draw once on entry. */
+	    /* Only enter once. */
 	    enter_room = 0;
 	}
+	snap.room = game_info.where;
+	snap.entry = rooms_entered;
+	snap.map_x = game_info.map_x;
+	snap.map_y = game_info.map_y;
+	snap.n_dirty = take_dirty_rects (snap.dirty, MAX_DIRTY_RECTS);
+	(void)pthread_mutex_unlock (&world_lock);
+
+	(void)pthread_mutex_lock (&msg_lock);
+	(void)strcpy (snap.status, status_msg);
+	(void)pthread_mutex_unlock (&msg_lock);
+	(void)strncpy (snap.typed, get_typed_command (), MAX_TYPED_LEN);
+	snap.typed[MAX_TYPED_LEN] = '\0';
 
-	show_screen ();
+	publish_frame (&snap);
 
-	//synchronize and call create_status_bar to make status bar
-	pthread_mutex_lock(&msg_lock);
-	create_status_bar(room_name(game_info.where),status_msg, get_typed_command());
-	pthread_mutex_unlock(&msg_lock);
 	/*
 	 * Wait for tick.  The tick defines the basic timing of our
 	 * event loop, and is the minimum amount of time between events.
@@ -325,6 +447,7 @@ game_loop ()
 	 */
   KB_cmd = CMD_NONE;
 	KB_cmd = get_command ();
+	(void)pthread_mutex_lock (&world_lock);
 	switch (KB_cmd) {
 	    case CMD_UP:    move_photo_down ();  break;
 	    case CMD_RIGHT: move_photo_left ();  break;
@@ -347,9 +470,16 @@ game_loop ()
 		    enter_room = 1;
 		}
 		break;
-	    case CMD_QUIT: return GAME_QUIT;
+	    case CMD_QUIT:
+		(void)pthread_mutex_unlock (&world_lock);
+		return GAME_QUIT;
 	    default: break;
 	}
+	if (CMD_NONE != KB_cmd) {
+	    /* Have the pre-render thread look for rooms that changed. */
+	    (void)pthread_cond_signal (&prerender_cv);
+	}
+	(void)pthread_mutex_unlock (&world_lock);
   //display current time on tux controller;
   prev = cur_time.tv_sec - start_time.tv_sec;
   display_time_on_tux(prev);
@@ -470,11 +600,12 @@ handle_typing ()
 	if (TC_CHANGE_ROOM == result) {
 	    return 1;
 	}
+	/* 
+	 * Objects moved by TC_REDRAW_ROOM are redrawn by the render thread
+	 * (see take_dirty_rects).
+	 */
 	if (TC_ALLOW_EDIT != result) {
 	    reset_typed_command ();
-	    if (TC_REDRAW_ROOM == result) {
-	        redraw_room ();
-	    }
 	}
 	return 0;
     }
@@ -513,13 +644,12 @@ init_game ()
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: shifts view window (drawn by the render thread)
  */
 static void
 move_photo_down ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.y_speed > game_info.map_y ?
@@ -527,12 +657,6 @@ move_photo_down ()
 
     /* Shift the logical view upward. */
     game_info.map_y -= delta;
-    set_view_window (game_info.map_x, game_info.map_y);
-
-    /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_horiz_line (idx);
-    }
 }
 
 
@@ -544,13 +668,12 @@ move_photo_down ()
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: shifts view window (drawn by the render thread)
  */
 static void
 move_photo_left ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_width (game_info.where) - SCROLL_X_DIM -
@@ -559,12 +682,6 @@ move_photo_left ()
 
     /* Shift the logical view to the right. */
     game_info.map_x += delta;
-    set_view_window (game_info.map_x, game_info.map_y);
-
-    /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_vert_line (SCROLL_X_DIM - idx);
-    }
 }
 
 
@@ -576,13 +693,12 @@ move_photo_left ()
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: shifts view window (drawn by the render thread)
  */
 static void
 move_photo_right ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
 
     /* Calculate the number of pixels by which to move. */
     delta = (game_info.x_speed > game_info.map_x ?
@@ -590,12 +706,6 @@ move_photo_right ()
 
     /* Shift the logical view to the left. */
     game_info.map_x -= delta;
-    set_view_window (game_info.map_x, game_info.map_y);
-
-    /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_vert_line (idx);
-    }
 }
 
 
@@ -607,13 +717,12 @@ move_photo_right ()
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: shifts view window (drawn by the render thread)
  */
 static void
 move_photo_up ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
 
     /* Calculate the number of pixels by which to move. */
     delta = room_photo_height (game_info.where) - SCROLL_Y_DIM -
@@ -622,12 +731,6 @@ move_photo_up ()
 
     /* Shift the logical view upward. */
     game_info.map_y += delta;
-    set_view_window (game_info.map_x, game_info.map_y);
-
-    /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_horiz_line (SCROLL_Y_DIM - idx);
-    }
 }
 
 
@@ -642,14 +745,515 @@ move_photo_up ()
 static void
 redraw_room ()
 {
-    int32_t i; /* index over rows */
+    int32_t y; /* first row of band */
 
-    /* Draw all lines in the scroll region. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-	(void)draw_horiz_line (i);
+    /* Draw all lines in the scroll region, a band at a time. */
+    for (y = 0; SCROLL_Y_DIM > y; y += REDRAW_BAND_ROWS) {
+	(void)draw_horiz_block (y, (SCROLL_Y_DIM - y < REDRAW_BAND_ROWS ?
+				    SCROLL_Y_DIM - y : REDRAW_BAND_ROWS));
     }
 }
 
+
+/*
+ * fill_horiz_locked
+ *   DESCRIPTION: Draw a horizontal line of the current room (see 
+ *                fill_horiz_buffer), holding world_lock while doing so.
+ *                Used by the render thread to draw the screen.  Nothing
+ *                is drawn once the player has left the room being drawn
+ *                (see fill_rect_locked).
+ *   INPUTS: (x,y) -- leftmost pixel of line to be drawn
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_horiz_locked (int x, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    (void)pthread_mutex_lock (&world_lock);
+    if (drawn_entry == rooms_entered) {
+	fill_horiz_buffer (x, y, buf);
+    }
+    (void)pthread_mutex_unlock (&world_lock);
+}
+
+
+/*
+ * fill_vert_locked
+ *   DESCRIPTION: Draw a vertical line of the current room (see 
+ *                fill_vert_buffer), holding world_lock while doing so.
+ *                Used by the render thread to draw the screen.  Nothing
+ *                is drawn once the player has left the room being drawn
+ *                (see fill_rect_locked).
+ *   INPUTS: (x,y) -- top pixel of line to be drawn
+ *   OUTPUTS: buf -- buffer holding image data for the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_vert_locked (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+{
+    (void)pthread_mutex_lock (&world_lock);
+    if (drawn_entry == rooms_entered) {
+	fill_vert_buffer (x, y, buf);
+    }
+    (void)pthread_mutex_unlock (&world_lock);
+}
+
+
+/*
+ * fill_rect_locked
+ *   DESCRIPTION: Draw a rectangle of the current room (see 
+ *                fill_rect_buffer), holding world_lock while doing so.
+ *                Used by the render thread to draw the screen; the lock
+ *                is released while the image is copied into the build
+ *                buffer, and between the bands drawn by redraw_room.
+ *                Once the player has entered another room, nothing is
+ *                drawn: the room being drawn (see prep_room) may no 
+ *                longer be kept in memory, and draw_frame drops the
+ *                frame.
+ *   INPUTS: (x,y) -- upper left pixel of rectangle to be drawn
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: buf -- buffer holding image data for the rectangle
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_rect_locked (int x, int y, int w, int h, unsigned char* buf)
+{
+    (void)pthread_mutex_lock (&world_lock);
+    if (drawn_entry == rooms_entered) {
+	fill_rect_buffer (x, y, w, h, buf);
+    }
+    (void)pthread_mutex_unlock (&world_lock);
+}
+
+
+/*
+ * redraw_changes
+ *   DESCRIPTION: Draw the parts of the screen showing parts of the room
+ *                that a snapshot records as changed (objects placed or
+ *                taken), or the whole screen if the room photo has
+ *                changed.  The view window must be at the snapshot's
+ *                position.
+ *   INPUTS: f -- the snapshot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the screen (but not the status bar)
+ */
+static void
+redraw_changes (const frame_t* f)
+{
+    const dirty_rect_t* rect;		/* changed parts of the room     */
+    int32_t      n;			/* number of changed parts       */
+    int32_t      i;			/* loop index over changed parts */
+    int32_t      x1, y1;		/* upper left of visible part    */
+    int32_t      x2, y2;		/* just past lower right of part */
+    int32_t      view_x, view_y;	/* upper left of screen in room  */
+
+    if (0 > (n = f->n_dirty)) {
+        redraw_room ();
+	return;
+    }
+
+    /* Draw the visible part of each changed rectangle. */
+    rect = f->dirty;
+    view_x = f->map_x;
+    view_y = f->map_y;
+    for (i = 0; n > i; i++) {
+	x1 = (rect[i].x > view_x ? rect[i].x : view_x);
+	y1 = (rect[i].y > view_y ? rect[i].y : view_y);
+	x2 = rect[i].x + rect[i].w;
+	if (x2 > view_x + SCROLL_X_DIM) {
+	    x2 = view_x + SCROLL_X_DIM;
+	}
+	y2 = rect[i].y + rect[i].h;
+	if (y2 > view_y + SCROLL_Y_DIM) {
+	    y2 = view_y + SCROLL_Y_DIM;
+	}
+	if (x1 < x2 && y1 < y2) {
+	    (void)draw_block (x1 - view_x, y1 - view_y,
+			      x2 - x1, y2 - y1);
+	}
+    }
+}
+
+/*
+ * scroll_view
+ *   DESCRIPTION: Move the view window to a new position in the room,
+ *                drawing the lines newly exposed, or the whole screen if
+ *                none of the old view remains in view.
+ *   INPUTS: (x,y) -- new upper left display pixel
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: shifts view window; draws into the screen (but not the
+ *                 status bar)
+ */
+static void
+scroll_view (int32_t x, int32_t y)
+{
+    int32_t dx; /* pixels moved to the right */
+    int32_t dy; /* pixels moved down         */
+
+    dx = x - drawn_x;
+    dy = y - drawn_y;
+    drawn_x = x;
+    drawn_y = y;
+    set_view_window (x, y);
+
+    if (SCROLL_X_DIM <= dx || -SCROLL_X_DIM >= dx ||
+        SCROLL_Y_DIM <= dy || -SCROLL_Y_DIM >= dy) {
+	redraw_room ();
+	return;
+    }
+
+    /* Draw the newly exposed lines. */
+    if (0 < dx) {
+	(void)draw_vert_block (SCROLL_X_DIM - dx, dx);
+    } else if (0 > dx) {
+	(void)draw_vert_block (0, -dx);
+    }
+    if (0 < dy) {
+	(void)draw_horiz_block (SCROLL_Y_DIM - dy, dy);
+    } else if (0 > dy) {
+	(void)draw_horiz_block (0, -dy);
+    }
+}
+
+
+/*
+ * draw_frame
+ *   DESCRIPTION: Draw a snapshot on the screen.  If the snapshot follows
+ *                a room entry that has not been drawn, the room is set up
+ *                for display (palette and photo drawing) and drawn in
+ *                full (from its image drawn ahead of time, if there is
+ *                one); otherwise, the view window is moved and the parts
+ *                of the room that changed are drawn.  A snapshot taken
+ *                before the player's latest room entry is not drawn (nor
+ *                shown, if the player enters a room while it is drawn).
+ *   INPUTS: f -- the snapshot
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws on the screen, including the status bar
+ */
+static void
+draw_frame (const frame_t* f)
+{
+    int32_t entered; /* snapshot follows a room entry not yet drawn */
+    int32_t redraw;  /* room entered must be drawn in full          */
+    int32_t stale;   /* player entered another room while drawing   */
+
+    /* 
+     * Drop a snapshot of a room that the player has since left.  On
+     * entry, read the room's photo and object images first (releasing
+     * world_lock), so that no file is read while holding the lock.
+     */
+    (void)pthread_mutex_lock (&world_lock);
+    do {
+	if (f->entry != rooms_entered) {
+	    (void)pthread_mutex_unlock (&world_lock);
+	    return;
+	}
+    } while (f->entry != drawn_entry &&
+	     read_room_images (f->room, &world_lock));
+
+    redraw = 0;
+    if (0 != (entered = (f->entry != drawn_entry))) {
+	drawn_entry = f->entry;
+	drawn_x = f->map_x;
+	drawn_y = f->map_y;
+	set_view_window (drawn_x, drawn_y);
+
+	/* Adjust colors and photo drawing for the current room photo. */
+	prep_room (f->room);
+
+	/* Copy the room's image, if drawn ahead of time. */
+	redraw = !show_prerendered (f->room);
+
+	/* Draw the rooms nearby ahead of time. */
+	prerender_near (f->room);
+    }
+    (void)pthread_mutex_unlock (&world_lock);
+
+    /* The fill functions take world_lock as needed. */
+    if (redraw) {
+	redraw_room ();
+    } else if (!entered) {
+	scroll_view (f->map_x, f->map_y);
+	redraw_changes (f);
+    }
+
+    /* 
+     * If the player entered another room meanwhile, the fill functions
+     * stopped drawing; the snapshot of that room redraws the screen.
+     */
+    (void)pthread_mutex_lock (&world_lock);
+    stale = (f->entry != rooms_entered);
+    (void)pthread_mutex_unlock (&world_lock);
+    if (stale) {
+        return;
+    }
+
+    show_screen ();
+    create_status_bar (room_name (f->room), f->status, f->typed);
+}
+
+
+/*
+ * publish_frame
+ *   DESCRIPTION: Hand a snapshot to the render thread.  If the render
+ *                thread has not taken the last snapshot published, the
+ *                new one replaces it, and the parts of the room that the
+ *                last one records as changed are added to the new one.
+ *   INPUTS: f -- the snapshot
+ *   OUTPUTS: f -- changed parts of the room added
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes the render thread
+ */
+static void
+publish_frame (frame_t* f)
+{
+    const frame_t* old;	/* snapshot not yet taken         */
+    int32_t        i;	/* loop index over changed parts  */
+
+    (void)pthread_mutex_lock (&frame_lock);
+    if (-1 != frame_ready) {
+	old = &frame[frame_ready];
+	if (old->entry == f->entry && 0 <= f->n_dirty) {
+	    if (0 > old->n_dirty || 
+		MAX_DIRTY_RECTS < old->n_dirty + f->n_dirty) {
+		f->n_dirty = -1;
+	    } else {
+		for (i = 0; old->n_dirty > i; i++) {
+		    f->dirty[f->n_dirty++] = old->dirty[i];
+		}
+	    }
+	}
+    } else {
+	/* Use the snapshot that the render thread is not drawing. */
+	frame_ready = (0 == frame_drawing ? 1 : 0);
+    }
+    frame[frame_ready] = *f;
+    (void)pthread_cond_signal (&frame_cv);
+    (void)pthread_mutex_unlock (&frame_lock);
+}
+
+
+/*
+ * render_thread
+ *   DESCRIPTION: Function executed by the render thread.  Waits for a
+ *                snapshot to be published, draws it, and repeats until
+ *                told to stop.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: draws on the screen
+ */
+static void*
+render_thread (void* ignore)
+{
+    (void)pthread_mutex_lock (&frame_lock);
+    while (1) {
+	while (!render_stop && -1 == frame_ready) {
+	    (void)pthread_cond_wait (&frame_cv, &frame_lock);
+	}
+	if (render_stop) {
+	    break;
+	}
+
+	/* Take the snapshot, and draw it without holding the lock. */
+	frame_drawing = frame_ready;
+	frame_ready = -1;
+	(void)pthread_mutex_unlock (&frame_lock);
+	draw_frame (&frame[frame_drawing]);
+	(void)pthread_mutex_lock (&frame_lock);
+	frame_drawing = -1;
+    }
+    (void)pthread_mutex_unlock (&frame_lock);
+    return NULL;
+}
+
+
+/*
+ * stop_render_thread
+ *   DESCRIPTION: Stops the render thread once it finishes drawing, and
+ *                waits for it to finish.  Used as a cleanup method to
+ *                ensure proper shutdown (before leaving mode X).
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+stop_render_thread (void* ignore)
+{
+    (void)pthread_mutex_lock (&frame_lock);
+    render_stop = 1;
+    (void)pthread_cond_signal (&frame_cv);
+    (void)pthread_mutex_unlock (&frame_lock);
+    (void)pthread_join (render_thread_id, NULL);
+}
+
+
+/*
+ * show_prerendered
+ *   DESCRIPTION: Put the current pre-rendered image of a room, if there is
+ *                one, in the build buffer.  The view must be at (0,0),
+ *                and the caller must hold world_lock.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the image was shown, or 0 if the room must be drawn
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static int32_t
+show_prerendered (const room_t* r)
+{
+    prerender_t* p;	/* image of room */
+
+    return (NULL != (p = find_prerendered (r)) && 
+	    0 == show_view_image (p->img));
+}
+
+
+/*
+ * find_prerendered
+ *   DESCRIPTION: Find the current pre-rendered image of a room.  The
+ *                caller must hold world_lock.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the image, or NULL if there is none
+ *   SIDE EFFECTS: none
+ */
+static prerender_t*
+find_prerendered (const room_t* r)
+{
+    int32_t i;	/* loop index over images */
+
+    for (i = 0; N_PRERENDER > i; i++) {
+	if (r == prerender[i].room && 
+	    room_version (r) == prerender[i].version) {
+	    return &prerender[i];
+	}
+    }
+    return NULL;
+}
+
+
+/*
+ * prerender_near
+ *   DESCRIPTION: Have the pre-render thread draw the rooms one move from
+ *                the room just entered.  Until the next call, the thread
+ *                keeps the images of those rooms current, so that the
+ *                image of the room being moved to is not replaced before
+ *                the room is entered.  The caller must hold world_lock.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: wakes the pre-render thread
+ */
+static void
+prerender_near (const room_t* r)
+{
+    prerender_from = r;
+    (void)pthread_cond_signal (&prerender_cv);
+}
+
+
+/*
+ * prerender_thread
+ *   DESCRIPTION: Function executed by the pre-render thread.  Draws each
+ *                room one move from prerender_from that has no current
+ *                image, replacing an image that is not a current image
+ *                of one of those rooms, then waits to be woken.  A room
+ *                is drawn only once its photo is in memory; the thread
+ *                reads the photo (or waits for it to be read) without
+ *                holding world_lock, so that commands are not held up.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: reads room photos if they are not in memory
+ */
+static void*
+prerender_thread (void* ignore)
+{
+    static unsigned char pixels[SCROLL_X_DIM * SCROLL_Y_DIM]; /* image  */
+    const room_t* near[3];	/* rooms one move from prerender_from */
+    const room_t* r;		/* room to be drawn                   */
+    prerender_t*  p;		/* image to be replaced               */
+    const room_t* tried = NULL;	/* room whose photo was last read     */
+    uint32_t      version;	/* version of room drawn              */
+    int32_t       i;		/* loop index over rooms or images    */
+
+    (void)pthread_mutex_lock (&world_lock);
+    while (1) {
+	/* Find a nearby room without a current image. */
+	r = NULL;
+	if (NULL != prerender_from) {
+	    room_neighbors (prerender_from, near);
+	    for (i = 0; 3 > i && NULL == r; i++) {
+		if (NULL != near[i] && NULL == find_prerendered (near[i])) {
+		    r = near[i];
+		}
+	    }
+	}
+	if (NULL == r) {
+	    (void)pthread_cond_wait (&prerender_cv, &world_lock);
+	    continue;
+	}
+
+	/* 
+	 * Keep the photo in memory while drawing.  If it or an object
+	 * image is not in memory, read them without the lock and look
+	 * again.  If they were read once and the photo was dropped again,
+	 * wait to be woken rather than read it over and over.
+	 */
+	if (read_room_images (r, &world_lock) || !pin_room_photo (r)) {
+	    if (tried == r) {
+		tried = NULL;
+		(void)pthread_cond_wait (&prerender_cv, &world_lock);
+	    } else {
+		tried = r;
+	    }
+	    continue;
+	}
+	tried = NULL;
+
+	/* 
+	 * Find an image that is stale or of a room not nearby.  At most
+	 * two of the images are current images of nearby rooms (r has
+	 * none), so one is found.
+	 */
+	for (i = 0; N_PRERENDER > i; i++) {
+	    p = &prerender[i];
+	    if (NULL == p->room || 
+		room_version (p->room) != p->version ||
+		(near[0] != p->room && near[1] != p->room && 
+		 near[2] != p->room)) {
+		break;
+	    }
+	}
+
+	/* 
+	 * Draw the room, then split the image into planes without holding
+	 * the lock.  If the room changes in the meantime, the image is
+	 * stale once done.
+	 */
+	version = room_version (r);
+	fill_room_rect (r, 0, 0, SCROLL_X_DIM, SCROLL_Y_DIM, pixels);
+	unpin_room_photo (r);
+	p->room = NULL;
+	(void)pthread_mutex_unlock (&world_lock);
+	make_view_image (pixels, p->img);
+	(void)pthread_mutex_lock (&world_lock);
+	p->room = r;
+	p->version = version;
+    }
+
+    /* not reached */
+    return NULL;
+}
+
+
 /*
  * tux_thread
  *   DESCRIPTION: game responds to tux buttons
@@ -663,6 +1267,7 @@ redraw_room ()
    while(1) {
      (void)pthread_mutex_lock(&controller_lock);
      pthread_cond_wait(&controller_cv, &controller_lock);
+     (void)pthread_mutex_lock (&world_lock);
      switch (tux_cmd) {
    	    case CMD_UP:    move_photo_down ();  break;
    	    case CMD_RIGHT: move_photo_left ();  break;
@@ -687,9 +1292,16 @@ redraw_room ()
    		break;
    	    case CMD_QUIT:
           terminate = 1;
+          (void)pthread_mutex_unlock (&world_lock);
+          (void)pthread_mutex_unlock (&controller_lock);
           return NULL;
    	    default: break;
    	}
+    if (CMD_NONE != tux_cmd) {
+	/* Have the pre-render thread look for rooms that changed. */
+	(void)pthread_cond_signal (&prerender_cv);
+    }
+    (void)pthread_mutex_unlock (&world_lock);
     (void)pthread_mutex_unlock(&controller_lock);
    }
    return NULL;
@@ -840,7 +1452,15 @@ show_status (const char* s)
 int
 main ()
 {
-    game_condition_t game;  /* outcome of playing */
+    game_condition_t game;  /* outcome of playing              */
+    uint32_t hits, misses;  /* rooms entered with/without photo */
+    uint32_t evictions;     /* photos dropped from memory       */
+    uint32_t bytes;         /* photo bytes held in memory       */
+    unsigned int shown;     /* screens shown                    */
+    unsigned int skipped;   /* show_screen calls with no change */
+    unsigned long copied;   /* bytes copied to video memory     */
+    unsigned int updates;   /* room palettes loaded             */
+    unsigned long writes;   /* writes to the palette ports      */
 
     /* Randomize for more fun (remove for deterministic layout). */
     srand (time (NULL));
@@ -862,12 +1482,27 @@ main ()
     }
     push_cleanup (cancel_status_thread, NULL); {
 
+	/* Create the thread that draws nearby rooms ahead of time. */
+	if (0 != pthread_create (&prerender_thread_id, NULL, 
+				 prerender_thread, NULL)) {
+	    PANIC ("failed to create pre-render thread");
+	}
+	push_cleanup (cancel_prerender_thread, NULL); {
+
 	/* Start mode X. */
-	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
+	if (0 != set_mode_X (fill_horiz_locked, fill_vert_locked, 
+			    fill_rect_locked)) {
 	    PANIC ("cannot initialize mode X");
 	}
 	push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
 
+	    /* Create the thread that draws the screen. */
+	    if (0 != pthread_create (&render_thread_id, NULL, render_thread, 
+				     NULL)) {
+		PANIC ("failed to create render thread");
+	    }
+	    push_cleanup (stop_render_thread, NULL); {
+
 	    /* Initialize the keyboard and/or Tux controller. */
 	    if (0 != init_input ()) {
 		PANIC ("cannot initialize input");
@@ -882,6 +1517,10 @@ main ()
   }pop_cleanup(1);
 	    } pop_cleanup (1);
 
+	    } pop_cleanup (1);
+
+	} pop_cleanup (1);
+
 	} pop_cleanup (1);
 
     } pop_cleanup (1);
@@ -892,6 +1531,19 @@ main ()
 	case GAME_QUIT: printf ("Quitter!\n"); break;
     }
 
+    /* Report the work done showing rooms (alongside the load times). */
+    room_photo_stats (&hits, &misses, &evictions, &bytes);
+    printf ("%8u  rooms entered with photo in memory (%u without)\n", 
+	    hits, misses);
+    printf ("%8u  photos dropped from memory (%u bytes held)\n", 
+	    evictions, bytes);
+    show_screen_stats (&shown, &skipped, &copied);
+    printf ("%8u  screens shown (%u unchanged, %lu bytes copied)\n", 
+	    shown, skipped, copied);
+    palette_stats (&updates, &writes);
+    printf ("%8u  room palettes loaded (%lu port writes)\n", updates, 
+	    writes);
+
     /* Return success. */
     return 0;
 }
@@ -0,0 +1,174 @@
+/*									tab:8
+ *
+ * linebench.c - line drawing throughput benchmark
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    linebench.c
+ */
+
+
+/*
+ * This file is a utility program that measures how quickly the game
+ * draws the lines that it adds to the screen as the view scrolls over a
+ * room (draw_vert_line and draw_horiz_line, which fetch each line from
+ * the room photo and objects with fill_rect_buffer and copy it into the
+ * build buffer).  In each room visited, the view is
+ * panned across the whole photo, one pixel at a time, from a number of
+ * starting rows, drawing the new vertical line at each step, and then
+ * down the photo from a number of starting columns, drawing the new
+ * horizontal line.  Drawing uses the software VGA (make VGA_EMULATION=1)
+ * unless the program is run with access to the hardware.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "modex.h"
+#include "photo.h"
+#include "world.h"
+
+
+#define N_ROOMS    12	// rooms visited
+#define PAN_STRIDE 1	// pixels between starting rows/columns of pans
+
+
+// The photo code lives alongside the game's world, which reports
+// through the status bar; there is none here.
+void
+show_status (const char* s)
+{
+}
+
+// Return nanoseconds elapsed since a start time.
+static double
+elapsed_nsec (const struct timespec* start)
+{
+    struct timespec now;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+// Pan right across a room, drawing vertical lines.  Return the number of
+// lines drawn.
+static long
+pan_right (const room_t* r)
+{
+    int  width = room_photo_width (r);
+    int  height = room_photo_height (r);
+    int  x;
+    int  y;
+    long lines = 0;
+
+    for (y = 0; height - SCROLL_Y_DIM >= y; y += PAN_STRIDE) {
+	set_view_window (0, y);
+	for (x = 1; width - SCROLL_X_DIM >= x; x++) {
+	    set_view_window (x, y);
+	    (void)draw_vert_line (SCROLL_X_DIM - 1);
+	    lines++;
+	}
+    }
+    return lines;
+}
+
+// Pan down a room, drawing horizontal lines.  Return the number of lines
+// drawn.
+static long
+pan_down (const room_t* r)
+{
+    int  width = room_photo_width (r);
+    int  height = room_photo_height (r);
+    int  x;
+    int  y;
+    long lines = 0;
+
+    for (x = 0; width - SCROLL_X_DIM >= x; x += PAN_STRIDE) {
+	set_view_window (x, 0);
+	for (y = 1; height - SCROLL_Y_DIM >= y; y++) {
+	    set_view_window (x, y);
+	    (void)draw_horiz_line (SCROLL_Y_DIM - 1);
+	    lines++;
+	}
+    }
+    return lines;
+}
+
+int
+main ()
+{
+    room_t*         r;
+    room_t*         last;
+    int             i;
+    struct timespec start;
+    long            vert_lines = 0;
+    long            horiz_lines = 0;
+    double          vert_nsec = 0;
+    double          horiz_nsec = 0;
+
+    // Build the world and take over the (possibly emulated) VGA.
+    srand (1);
+    if (!build_world ()) {
+        fprintf (stderr, "cannot build the world\n");
+	return 2;
+    }
+    r = start_in_room ();
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer,
+			 fill_rect_buffer)) {
+        fprintf (stderr, "cannot set mode X\n");
+	return 2;
+    }
+
+    // Walk through the rooms, panning across each one.
+    for (i = 0; N_ROOMS > i; i++) {
+	room_entered (r);
+	prep_room (r);
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	vert_lines += pan_right (r);
+	vert_nsec += elapsed_nsec (&start);
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	horiz_lines += pan_down (r);
+	horiz_nsec += elapsed_nsec (&start);
+
+	last = r;
+	(void)try_to_move_right (&r);
+	if (last == r) {
+	    (void)try_to_enter (&r);
+	}
+	if (last == r) {
+	    (void)try_to_move_left (&r);
+	}
+    }
+    clear_mode_X ();
+
+    printf ("draw_vert_line:  %9ld lines %8.1f ns/line %7.1f Mpixel/s\n",
+	    vert_lines, vert_nsec / vert_lines,
+	    vert_lines * SCROLL_Y_DIM * 1e3 / vert_nsec);
+    printf ("draw_horiz_line: %9ld lines %8.1f ns/line %7.1f Mpixel/s\n",
+	    horiz_lines, horiz_nsec / horiz_lines,
+	    horiz_lines * SCROLL_X_DIM * 1e3 / horiz_nsec);
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*									tab:8
+ *
+ * mkpack.c - asset pack builder
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    mkpack.c
+ */
+
+/*
+ * This file is a utility program that gathers room photos and object
+ * images into one asset pack (see pack.h) for the Fall 2011 ECE391 MP2
+ * adventure game.  Files named *.obj are object images; all others are
+ * room photos.  Each asset is named in the pack exactly as it is named
+ * on the command line, which must match the name that the game uses
+ * (for example, "images/foyer.photo").
+ *
+ * Room photos are quantized just as the game would quantize them, and
+ * the palettes and pixels are stored.  With -r, photos are stored as
+ * 5:6:5 pixels instead, and the game quantizes them as they are loaded.
+ *
+ * The pack is written under a temporary name and then renamed.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pack.h"
+#include "photo.h"
+
+
+// One asset being packed.
+typedef struct asset_t asset_t;
+struct asset_t {
+    pack_entry_t   entry;	// index entry
+    photo_t*       photo;	// quantized photo, or NULL
+    image_t*       image;	// object image, or NULL
+    uint16_t*      raw;		// 5:6:5 photo pixels (-r), or NULL
+    const uint8_t* data;	// pixel data to write
+    size_t         size;	// bytes of pixel data
+};
+
+
+// The photo code lives alongside the game's world, which reports
+// through the status bar; there is none here.
+void
+show_status (const char* s)
+{
+}
+
+// Compare two asset names (for qsort).
+static int
+compare_names (const void* left, const void* right)
+{
+    return strcmp (*(char* const*)left, *(char* const*)right);
+}
+
+// Check whether a file name ends with a suffix.
+static int
+has_suffix (const char* fname, const char* suffix)
+{
+    size_t len = strlen (fname);
+    size_t slen = strlen (suffix);
+
+    return (len >= slen && 0 == strcmp (fname + len - slen, suffix));
+}
+
+// Read a room photo file's header and 5:6:5 pixels without quantizing.
+// Returns pointer to the pixels (dynamically allocated) on success, or
+// NULL on failure.
+static uint16_t*
+read_raw_photo (const char* fname, photo_header_t* hdr)
+{
+    FILE*     in;
+    uint16_t* pixels = NULL;
+
+    if (NULL == (in = fopen (fname, "rb"))) {
+        return NULL;
+    }
+    if (1 != fread (hdr, sizeof (*hdr), 1, in) ||
+	MAX_PHOTO_WIDTH < hdr->width || MAX_PHOTO_HEIGHT < hdr->height ||
+	NULL == (pixels = malloc (hdr->width * hdr->height *
+				  sizeof (pixels[0]))) ||
+	hdr->height != fread (pixels, hdr->width * sizeof (pixels[0]),
+			      hdr->height, in)) {
+	free (pixels);
+	pixels = NULL;
+    }
+    (void)fclose (in);
+    return pixels;
+}
+
+// Read one asset and fill in its index entry (except offsets).  Returns
+// 1 on success, 0 on failure.
+static int
+read_asset (asset_t* a, const char* fname, int raw_photos)
+{
+    (void)memset (a, 0, sizeof (*a));
+    if (PACK_NAME_LEN <= strlen (fname)) {
+        fprintf (stderr, "%s: name is too long for the pack.\n", fname);
+	return 0;
+    }
+    strcpy (a->entry.name, fname);
+
+    if (has_suffix (fname, ".obj")) {
+	a->entry.kind = PACK_OBJECT;
+	if (NULL == (a->image = read_obj_image (fname))) {
+	    fprintf (stderr, "%s is not a valid object image.\n", fname);
+	    return 0;
+	}
+	a->entry.hdr.width = image_width (a->image);
+	a->entry.hdr.height = image_height (a->image);
+	a->data = image_data (a->image);
+    } else if (raw_photos) {
+	a->entry.kind = PACK_PHOTO_RAW;
+	if (NULL == (a->raw = read_raw_photo (fname, &a->entry.hdr))) {
+	    fprintf (stderr, "%s is not a valid room photo.\n", fname);
+	    return 0;
+	}
+	a->data = (const uint8_t*)a->raw;
+    } else {
+	a->entry.kind = PACK_PHOTO;
+	if (NULL == (a->photo = read_photo (fname))) {
+	    fprintf (stderr, "%s is not a valid room photo.\n", fname);
+	    return 0;
+	}
+	a->entry.hdr.width = photo_width (a->photo);
+	a->entry.hdr.height = photo_height (a->photo);
+	a->data = photo_data (a->photo);
+    }
+    if (PACK_PHOTO == a->entry.kind) {
+	a->size = PHOTO_TILED_SIZE (a->entry.hdr.width, a->entry.hdr.height);
+    } else {
+	a->size = a->entry.hdr.width * a->entry.hdr.height *
+		  (PACK_PHOTO_RAW == a->entry.kind ? sizeof (uint16_t) : 1);
+    }
+    return 1;
+}
+
+// Write the header, index, palettes, and pixel data to the output file.
+// Return 1 on success, 0 on failure.
+static int
+write_pack (FILE* out, asset_t* asset, uint32_t n)
+{
+    pack_header_t hdr;
+    uint32_t      offset;
+    uint32_t      i;
+
+    // Lay out the palettes after the index, then the pixel data.
+    offset = sizeof (hdr) + n * sizeof (asset[0].entry);
+    for (i = 0; n > i; i++) {
+	if (PACK_PHOTO == asset[i].entry.kind) {
+	    asset[i].entry.palette = offset;
+	    offset += 192 * 3;
+	}
+    }
+    for (i = 0; n > i; i++) {
+	offset = (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+	asset[i].entry.pixels = offset;
+	offset += asset[i].size;
+    }
+
+    // Write the header and index.
+    hdr.magic = PACK_MAGIC;
+    hdr.version = PACK_VERSION;
+    hdr.quantizer_version = QUANTIZER_VERSION;
+    hdr.n_entries = n;
+    if (1 != fwrite (&hdr, sizeof (hdr), 1, out)) {
+        perror ("write header to pack");
+	return 0;
+    }
+    for (i = 0; n > i; i++) {
+	if (1 != fwrite (&asset[i].entry, sizeof (asset[i].entry), 1, out)) {
+	    perror ("write index to pack");
+	    return 0;
+	}
+    }
+
+    // Write the palettes and pixel data at their offsets.
+    for (i = 0; n > i; i++) {
+	if (PACK_PHOTO == asset[i].entry.kind &&
+	    1 != fwrite (photo_colors (asset[i].photo), 192 * 3, 1, out)) {
+	    perror ("write palette to pack");
+	    return 0;
+	}
+    }
+    for (i = 0; n > i; i++) {
+	if (0 != fseek (out, asset[i].entry.pixels, SEEK_SET) ||
+	    1 != fwrite (asset[i].data, asset[i].size, 1, out)) {
+	    perror ("write pixel data to pack");
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+int
+main (int argc, char* argv[])
+{
+    int      raw_photos = 0;
+    char**   names;
+    uint32_t n;
+    asset_t* asset;
+    uint32_t i;
+    char     tmp[256];
+    FILE*    out;
+    int32_t  written;
+
+    // Check syntax of invocation.
+    if (1 < argc && 0 == strcmp (argv[1], "-r")) {
+        raw_photos = 1;
+	argc--;
+	argv++;
+    }
+    if (3 > argc) {
+    	fprintf (stderr, "usage: %s [-r] <pack file> <photo or object file> "
+		 "...\n", argv[0]);
+	return 2;
+    }
+
+    // The pack is indexed in name order.
+    names = &argv[2];
+    n = argc - 2;
+    qsort (names, n, sizeof (names[0]), compare_names);
+    for (i = 1; n > i; i++) {
+	if (0 == strcmp (names[i - 1], names[i])) {
+	    fprintf (stderr, "%s is named twice.\n", names[i]);
+	    return 2;
+	}
+    }
+
+    // Read every asset from its own file (not from an old pack).
+    pack_ignore ();
+    if (NULL == (asset = malloc (n * sizeof (asset[0])))) {
+        perror ("allocate assets");
+	return 2;
+    }
+    for (i = 0; n > i; i++) {
+	if (!read_asset (&asset[i], names[i], raw_photos)) {
+	    return 2;
+	}
+    }
+
+    // Try to write, close, and rename the output file.
+    (void)snprintf (tmp, sizeof (tmp), "%s.tmp", argv[1]);
+    if (NULL == (out = fopen (tmp, "w+b"))) {
+        perror ("open output file");
+	return 2;
+    }
+    written = write_pack (out, asset, n);
+    if (EOF == fclose (out)) {
+	perror ("close output file");
+        written = 0;
+    }
+    if (written && 0 != rename (tmp, argv[1])) {
+	perror ("rename output file");
+	written = 0;
+    }
+    if (!written) {
+	(void)remove (tmp);
+    }
+
+    // Return value based on success of output file write and close.
+    return (written ? 0 : 3);
+}
@@ -43,36 +43,64 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/io.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "modex.h"
 #include "text.h"
+#include "vgaemu.h"
+
+
+/*
+ * Set VGA_EMULATION to 1 (make VGA_EMULATION=1) to draw into the software
+ * VGA in vgaemu.c rather than the hardware.  The emulated build needs
+ * neither ioperm nor /dev/mem, so the rendering code can be run and
+ * profiled as an ordinary (and not necessarily 32-bit x86) process.
+ */
+#if !defined(VGA_EMULATION)
+#define VGA_EMULATION 0		/* default to the real VGA */
+#endif
+
+#if (0 == VGA_EMULATION)
+#include <sys/io.h>
+#endif
+
+/*
+ * Set USE_SIMD_PLANAR to 0 to split rows of pixels into the four mode X
+ * planes four pixels at a time rather than 64 at a time with SSE2 (see
+ * copy_to_planes).  SSE2 is used by default on x86 processors that have
+ * it.
+ */
+#if !defined(USE_SIMD_PLANAR)
+#if defined(__i386__) || defined(__x86_64__)
+#define USE_SIMD_PLANAR 1
+#else
+#define USE_SIMD_PLANAR 0
+#endif
+#endif
+#if (1 == USE_SIMD_PLANAR)
+#include <immintrin.h>
+#endif
 
 
 /*
  * Calculate the image build buffer parameters.  SCROLL_SIZE is the space
  * needed for one plane of an image.  SCREEN_SIZE is the space needed for
- * all four planes.  The extra +1 supports logical view x coordinates that
- * are not multiples of four.  In these cases, some plane addresses are
- * shifted by 1 byte forward.  The planes are stored in the build buffer
- * in reverse order to allow those planes that shift forward to do so
- * without running into planes that aren't shifted.  For example, when
- * the leftmost x pixel in the logical view is 3 mod 4, planes 2, 1, and 0
- * are shifted forward, while plane 3 is not, so there is one unused byte
- * between the image of plane 3 and that of plane 2.  BUILD_BUF_SIZE is
- * the size of the space allocated for building images.  We add 20000 bytes
- * to reduce the number of memory copies required during scrolling.
- * Strictly speaking (try it), no extra space is necessary, but the minimum
- * means an extra 64kB memory copy with every scroll pixel.  Finally,
- * BUILD_BASE_INIT places initial (or transferred) logical view in the
- * middle of the available buffer area.
+ * all four planes, and the build buffer holds exactly that much.  Each
+ * plane is a ring: a logical pixel (x,y) lives in plane (x & 3) at the
+ * linear address (x >> 2) + y * SCROLL_X_WIDTH taken modulo SCROLL_SIZE
+ * (BUILD_RING_OFF).  The pixels of one plane that are visible in the
+ * logical view window have SCROLL_SIZE consecutive linear addresses, so
+ * they never collide in the ring, and a pixel keeps its place in the
+ * buffer as the view window moves.  Scrolling thus never moves data
+ * within the buffer; show_screen instead copies each plane out in (at
+ * most) two pieces, one on each side of the end of the ring.
  */
 #define SCROLL_SIZE     (SCROLL_X_WIDTH * SCROLL_Y_DIM)
-#define SCREEN_SIZE	(SCROLL_SIZE * 4 + 1)
-#define BUILD_BUF_SIZE  (SCREEN_SIZE + 20000)
-#define BUILD_BASE_INIT ((BUILD_BUF_SIZE - SCREEN_SIZE) / 2)
+#define SCREEN_SIZE	(SCROLL_SIZE * 4)
+#define BUILD_BUF_SIZE  SCREEN_SIZE
+#define BUILD_RING_OFF(x,y) (((y) * SCROLL_X_WIDTH + ((x) >> 2)) % SCROLL_SIZE)
+#define BUILD_PLANE(p)  (build + MEM_FENCE_WIDTH + (p) * SCROLL_SIZE)
 
 /* Mode X and general VGA parameters */
 #define VID_MEM_SIZE       131072
@@ -144,8 +172,23 @@ static void fill_palette_mode_x ();
 static void fill_palette_text ();
 static void write_font_data ();
 static void set_text_mode_3 (int clear_scr);
-static void copy_image (unsigned char* img, unsigned short scr_addr);
+static void copy_image (unsigned char* img, unsigned short scr_addr, int n);
+static void mark_rows_changed (int first, int n);
+static void show_status_img ();
 static void copy_status_bar (unsigned char* img, unsigned short scr_addr);
+static void copy_to_planes (unsigned char* const plane[4], int x,
+			    const unsigned char* src, int n);
+#if (1 == USE_SIMD_PLANAR)
+static int copy_to_planes_sse2 (unsigned char* const plane[4], int x,
+				const unsigned char* src, int n)
+				__attribute__ ((target ("sse2")));
+static __m128i plane_bytes (const __m128i v[4], int p)
+			    __attribute__ ((target ("sse2")));
+#endif /* USE_SIMD_PLANAR */
+#if !defined(TEXT_RESTORE_PROGRAM)
+static void fill_rect_from_lines (int x, int y, int w, int h, 
+				  unsigned char* buf);
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
 
 
 
@@ -158,15 +201,9 @@ static void copy_status_bar (unsigned char* img, unsigned short scr_addr);
  * the number of video memory writes; unfortunately, these techniques
  * are slower in emulation...).
  *
- * The size allows the four plane images to move within an area of
- * about twice the size necessary (to reduce the need to deal with
- * the boundary conditions by moving the data within the buffer).
- *
- * Plane 3 is first, followed by 2, 1, and 0.  The reverse ordering
- * is used because the logical address of 0 increases first; if plane
- * 0 were first, we would need a buffer byte to keep it from colliding
- * with plane 1 when plane 0 was offset by 1 from plane 1, i.e., when
- * displaying a one-pixel left shift.
+ * Plane 0 is first, followed by 1, 2, and 3, each a ring of SCROLL_SIZE
+ * bytes (see BUILD_RING_OFF).  Use BUILD_PLANE to find the start of
+ * a plane.
  *
  * The memory fence (included when NDEBUG is not defined) allocates
  * the build buffer with extra space on each side.  The extra space
@@ -182,23 +219,106 @@ static void copy_status_bar (unsigned char* img, unsigned short scr_addr);
 #endif
 #define MEM_FENCE_MAGIC 0xF3
 static unsigned char build[BUILD_BUF_SIZE + 2 * MEM_FENCE_WIDTH];
-static int img3_off;		    /* offset of upper left pixel   */
-static unsigned char* img3;	    /* pointer to upper left pixel  */
 static int show_x, show_y;          /* logical view coordinates     */
 
 /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
 static unsigned short target_img;   /* offset of displayed screen image */
 
+/*
+ * Video memory holds two screens, at STAT_BAR_SIZE and 0x4000 beyond it,
+ * and show_screen draws into the one not displayed, then displays it.
+ * For each screen, these record which rows of the logical view window
+ * have changed (been drawn, or moved by moving the window) since the
+ * screen was last drawn, so that show_screen need copy only those rows,
+ * and need do nothing at all if the displayed screen has no changes.
+ * Screen (target_img >> 14) is the one displayed.
+ */
+static unsigned char row_changed[2][SCROLL_Y_DIM];
+static int screen_changed[2];	    /* any row changed for screen?      */
+static unsigned int frames_shown;   /* screens drawn by show_screen     */
+static unsigned int frames_skipped; /* calls with nothing to draw       */
+static unsigned long bytes_copied;  /* bytes copied by show_screen      */
+
+/*
+ * A copy of the colors in the VGA palette (the DAC) lets update_palette
+ * write only the colors that change.  The copy is valid only after all
+ * 256 colors have been written by update_palette; setting up a video
+ * mode changes some colors behind its back and so invalidates it.
+ */
+static unsigned char dac_image[256][3]; /* colors in the VGA palette    */
+static int dac_image_valid;	    /* dac_image matches the VGA?       */
+static unsigned int palette_updates; /* calls to update_palette         */
+static unsigned long palette_writes; /* palette port writes             */
+
+/*
+ * The status bar is kept as an image split into planes, along with the
+ * strings drawn in it, and is drawn again only when a string changes.
+ * It is copied into video memory (which holds one status bar for both
+ * screens) only when it has been drawn again or video memory cleared.
+ * Strings longer than STAT_BAR_TEXT_LEN are not kept, and the status bar
+ * is drawn again each time that they are shown.
+ */
+#define STAT_BAR_TEXT_LEN 80
+static unsigned char status_img[4 * STAT_BAR_SIZE];
+static char status_text[3][STAT_BAR_TEXT_LEN + 1]; /* room, status, input */
+static int status_img_valid;	    /* status_img shows status_text?    */
+static int status_img_shown;	    /* video memory holds status_img?   */
+
 
 /*
  * functions provided by the caller to set_mode_X() and used to obtain
- * graphic images of lines (pixels) to be mapped into the build buffer
- * planes for display in mode X
+ * graphic images of lines or rectangles (pixels) to be mapped into the
+ * build buffer planes for display in mode X
  */
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
+#if !defined(TEXT_RESTORE_PROGRAM)
+static void (*rect_fn) (int, int, int, int, unsigned char*);
+
+/* image of the block being drawn (up to the whole logical view window) */
+static unsigned char block[SCROLL_X_DIM * SCROLL_Y_DIM];
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
+
 
+#if (1 == VGA_EMULATION)
+
+/*
+ * The macros below mirror the hardware versions that follow, but update
+ * the software VGA in vgaemu.c instead of writing to ports.
+ */
+#define SET_WRITE_MASK(mask_hi_bits)                                    \
+do {                                                                    \
+    vga_emu_outw (0x03C4, ((mask_hi_bits) & 0xFF00) | 0x02);            \
+} while (0)
+
+#define OUTB(port,val)                                                  \
+do {                                                                    \
+    vga_emu_outb ((port), (val));                                       \
+} while (0)
+
+#define OUTW(port,val)                                                  \
+do {                                                                    \
+    vga_emu_outw ((port), (val));                                       \
+} while (0)
+
+#define REP_OUTSW(port,source,count)                                    \
+do {                                                                    \
+    const unsigned short* _src = (const unsigned short*)(source);       \
+    int _cnt;                                                           \
+    for (_cnt = (count); 0 < _cnt; _cnt--)                              \
+        vga_emu_outw ((port), *_src++);                                 \
+} while (0)
+
+#define REP_OUTSB(port,source,count)                                    \
+do {                                                                    \
+    const unsigned char* _src = (const unsigned char*)(source);         \
+    int _cnt;                                                           \
+    for (_cnt = (count); 0 < _cnt; _cnt--)                              \
+        vga_emu_outb ((port), *_src++);                                 \
+} while (0)
+
+#else /* (0 == VGA_EMULATION) */
 
 /*
  * macro used to target a specific video plane or planes when writing
@@ -266,6 +386,8 @@ do {                                                                    \
       : "eax", "memory", "cc");                                         \
 } while (0)
 
+#endif /* VGA_EMULATION */
+
 
 /*
  * set_mode_X
@@ -278,6 +400,12 @@ do {                                                                    \
  *   			     draw_vert_line) to obtain a graphical
  *   			     image of a particular logical line for
  *   			     drawing to the build buffer
+ *           rect_fill_fn -- this function is used as a callback (by
+ *   			     the line and block drawing functions) to
+ *   			     obtain a graphical image of a logical
+ *   			     rectangle for drawing to the build buffer;
+ *   			     if NULL, rectangles are built from lines
+ *   			     (and the line functions must be given)
  *   OUTPUTS: none
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: initializes the logical view window; maps video memory
@@ -285,23 +413,25 @@ do {                                                                    \
  */
 int
 set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
-            void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]))
+            void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]),
+	    void (*rect_fill_fn) (int, int, int, int, unsigned char*))
 {
     int i; /* loop index for filling memory fence with magic numbers */
 
     /*
      * Record callback functions for obtaining horizontal and vertical
-     * line images.
+     * line images and rectangle images.
      */
-    if (horiz_fill_fn == NULL || vert_fill_fn == NULL)
+    if (rect_fill_fn == NULL && (horiz_fill_fn == NULL || vert_fill_fn == NULL))
         return -1;
     horiz_line_fn = horiz_fill_fn;
     vert_line_fn = vert_fill_fn;
+#if !defined(TEXT_RESTORE_PROGRAM)
+    rect_fn = (rect_fill_fn != NULL ? rect_fill_fn : fill_rect_from_lines);
+#endif /* !defined(TEXT_RESTORE_PROGRAM) */
 
     /* Initialize the logical view window to position (0,0). */
     show_x = show_y = 0;
-    img3_off = BUILD_BASE_INIT;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
 
     /* Set up the memory fence on the build buffer. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -360,8 +490,10 @@ clear_mode_X ()
     /* Put VGA into text mode, restore font data, and clear screens. */
     set_text_mode_3 (1);
 
+#if (0 == VGA_EMULATION)
     /* Unmap video memory. */
     (void)munmap (mem_image, VID_MEM_SIZE);
+#endif
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -381,31 +513,21 @@ clear_mode_X ()
 
 /*
  * set_view_window
- *   DESCRIPTION: Set the logical view window, moving its location within
- *                the build buffer if necessary to keep all on-screen data
- *                in the build buffer.  If the location within the build
- *                buffer moves, this function copies all data from the old
- *                window that are within the new screen to the appropriate
- *                new location, so only data not previously on the screen
- *                must be drawn before calling show_screen.
+ *   DESCRIPTION: Set the logical view window.  Pixels keep their places
+ *                in the build buffer as the window moves (see
+ *                BUILD_RING_OFF), so all data from the old window that
+ *                are within the new screen remain valid, and only data
+ *                not previously on the screen must be drawn before
+ *                calling show_screen.
  *   INPUTS: (scr_x,scr_y) -- new upper left pixel of logical view window
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: may shift position of logical view window within build
- *                 buffer
+ *   SIDE EFFECTS: marks the whole screen as changed if the window moved
  */
 void
 set_view_window (int scr_x, int scr_y)
 {
-    int old_x, old_y;     /* old position of logical view window           */
-    int start_x, start_y; /* starting position for copying from old to new */
-    int end_x, end_y;     /* ending position for copying from old to new   */
-    int start_off;        /* offset of copy start relative to old build    */
-     		          /*    buffer start position                      */
-    int length;           /* amount of data to be copied                   */
-    int i;	          /* copy loop index                               */
-    unsigned char* start_addr;  /* starting memory address of copy     */
-    unsigned char* target_addr; /* destination memory address for copy */
+    int old_x, old_y;     /* old position of logical view window */
 
     /* Record the old position. */
     old_x = show_x;
@@ -415,87 +537,18 @@ set_view_window (int scr_x, int scr_y)
     show_x = scr_x;
     show_y = scr_y;
 
-    /*
-     * If the new view window fits within the boundaries of the build
-     * buffer, we need move nothing around.
-    */
-    if (img3_off + (scr_x >> 2) + scr_y * SCROLL_X_WIDTH >= 0 &&
-        img3_off + 3 * SCROLL_SIZE +
-	    ((scr_x + SCROLL_X_DIM - 1) >> 2) +
-	    (scr_y + SCROLL_Y_DIM - 1) * SCROLL_X_WIDTH < BUILD_BUF_SIZE)
-	return;
-
-    /*
-     * If the new screen does not overlap at all with the old screen, none
-     * of the old data need to be saved, and we can simply reposition the
-     * valid window of the build buffer in the middle of that buffer.
-     */
-    if (scr_x <= old_x - SCROLL_X_DIM || scr_x >= old_x + SCROLL_X_DIM ||
-	scr_y <= old_y - SCROLL_Y_DIM || scr_y >= old_y + SCROLL_Y_DIM) {
-	img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
-	img3 = build + img3_off + MEM_FENCE_WIDTH;
-	return;
-    }
-
-    /*
-     * Any still-visible portion of the old screen should be retained.
-     * Rather than clipping exactly, we copy all contiguous data between
-     * a clipped starting point to a clipped ending point (which may
-     * include non-visible data).
-     *
-     * The starting point is the maximum (x,y) coordinates between the
-     * new and old screens.  The ending point is the minimum (x,y)
-     * coordinates between the old and new screens (offset by the screen
-     * size).
-     */
-    if (scr_x > old_x) {
-        start_x = scr_x;
-	end_x = old_x;
-    } else {
-        start_x = old_x;
-	end_x = scr_x;
-    }
-    end_x += SCROLL_X_DIM - 1;
-    if (scr_y > old_y) {
-        start_y = scr_y;
-	end_y = old_y;
-    } else {
-        start_y = old_y;
-	end_y = scr_y;
-    }
-    end_y += SCROLL_Y_DIM - 1;
-
-    /*
-     * We now calculate the starting and ending addresses for the copy
-     * as well as the new offsets for use with the build buffer.  The
-     * length to be copied is basically the ending offset minus the starting
-     * offset plus one (plus the three screens in between planes 3 and 0).
-     */
-    start_off = (start_x >> 2) + start_y * SCROLL_X_WIDTH;
-    start_addr = img3 + start_off;
-    length = (end_x >> 2) + end_y * SCROLL_X_WIDTH + 1 - start_off +
-	     3 * SCROLL_SIZE;
-    img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-    target_addr = img3 + start_off;
-
-    /*
-     * Copy the relevant portion of the screen from the old location to the
-     * new one.  The areas may overlap, so copy direction is important.
-     * (You should be able to explain why!)
-     */
-    if (start_addr < target_addr)
-	for (i = length; i-- > 0; )
-	    target_addr[i] = start_addr[i];
-    else
-	for (i = 0; i < length; i++)
-	    target_addr[i] = start_addr[i];
+    /* Every row on the screen shows something new if the window moved. */
+    if (scr_x != old_x || scr_y != old_y)
+	mark_rows_changed (0, SCROLL_Y_DIM);
 }
 
 
 /*
  * show_screen
- *   DESCRIPTION: Show the logical view window on the video display.
+ *   DESCRIPTION: Show the logical view window on the video display.  Only
+ *                the rows changed since the target screen was last drawn
+ *                are copied, and if the displayed screen is up to date,
+ *                nothing is done.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -505,28 +558,55 @@ set_view_window (int scr_x, int scr_y)
 void
 show_screen ()
 {
-    unsigned char* addr;  /* source address for copy             */
-    int p_off;            /* plane offset of first display plane */
-    int i;		  /* loop index over video planes        */
-
-    /*
-     * Calculate offset of build buffer plane to be mapped into plane 0
-     * of display.
-     */
-    p_off = (3 - (show_x & 3));
+    unsigned char* plane;   /* build buffer plane for video plane */
+    unsigned char* changed; /* rows changed for target screen     */
+    int off;		    /* ring offset of plane's first pixel */
+    int src;		    /* ring offset of a run of rows       */
+    int len;		    /* bytes in the run                   */
+    int part;		    /* bytes before the end of the ring   */
+    int i;		    /* loop index over video planes       */
+    int first;		    /* first row of a run of changed rows */
+    int end;		    /* row after the run                  */
+
+    /* Nothing to do if the displayed screen shows the build buffer. */
+    if (!screen_changed[target_img >> 14]) {
+        frames_skipped++;
+	return;
+    }
 
     /* Switch to the other target screen in video memory. */
     target_img ^= 0x4000;
+    changed = row_changed[target_img >> 14];
 
-    /* Calculate the source address. */
-    addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
-
-    /* Draw to each plane in the video memory. */
+    /*
+     * Draw each run of changed rows to each plane in the video memory.
+     * Video plane i shows the logical pixels show_x + i, show_x + i + 4,
+     * and so forth; runs that wrap around the end of the build buffer
+     * plane's ring are copied in two pieces.
+     */
     for (i = 0; i < 4; i++) {
 	SET_WRITE_MASK (1 << (i + 8));
-	copy_image (addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i),
-	            target_img);
+	plane = BUILD_PLANE ((show_x + i) & 3);
+	off = BUILD_RING_OFF (show_x + i, show_y);
+	for (first = 0; first < SCROLL_Y_DIM; first = end) {
+	    for (; first < SCROLL_Y_DIM && !changed[first]; first++);
+	    for (end = first; end < SCROLL_Y_DIM && changed[end]; end++);
+	    if (first < end) {
+		src = (off + first * SCROLL_X_WIDTH) % SCROLL_SIZE;
+		len = (end - first) * SCROLL_X_WIDTH;
+		part = (src + len > SCROLL_SIZE ? SCROLL_SIZE - src : len);
+		copy_image (plane + src, target_img + first * SCROLL_X_WIDTH,
+			    part);
+		if (part < len)
+		    copy_image (plane, target_img + first * SCROLL_X_WIDTH +
+				part, len - part);
+		bytes_copied += len;
+	    }
+	}
     }
+    memset (changed, 0, SCROLL_Y_DIM);
+    screen_changed[target_img >> 14] = 0;
+    frames_shown++;
 
     /*
      * Change the VGA registers to point the top left of the screen
@@ -536,6 +616,49 @@ show_screen ()
     OUTW (0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
 }
 
+
+/*
+ * show_screen_stats
+ *   DESCRIPTION: Get counts of the work done by show_screen.
+ *   INPUTS: none
+ *   OUTPUTS: shown -- number of screens drawn and displayed
+ *            skipped -- number of calls with no change to display
+ *            bytes -- bytes copied to video memory (all planes)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+show_screen_stats (unsigned int* shown, unsigned int* skipped, 
+		   unsigned long* bytes)
+{
+    *shown = frames_shown;
+    *skipped = frames_skipped;
+    *bytes = bytes_copied;
+}
+
+
+/*
+ * mark_rows_changed
+ *   DESCRIPTION: Record that rows of the logical view window have changed
+ *                in the build buffer, so that show_screen copies them to
+ *                both screens in video memory.
+ *   INPUTS: first -- the first row changed
+ *           n -- the number of rows changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the rows for both screens
+ */
+static void
+mark_rows_changed (int first, int n)
+{
+    int i; /* loop index over screens */
+
+    for (i = 0; i < 2; i++) {
+	memset (row_changed[i] + first, 1, n);
+	screen_changed[i] = 1;
+    }
+}
+
 /*
  * clear_screens
  *   DESCRIPTION: Fills the video memory with zeroes.
@@ -551,53 +674,303 @@ clear_screens ()
     SET_WRITE_MASK (0x0F00);
 
     /* Set 64kB to zero (times four planes = 256kB). */
+#if (1 == VGA_EMULATION)
+    vga_emu_fill (0, 0, MODE_X_MEM_SIZE);
+#else
     memset (mem_image, 0, MODE_X_MEM_SIZE);
+#endif
+
+    /* Neither screen shows the build buffer now, nor the status bar. */
+    mark_rows_changed (0, SCROLL_Y_DIM);
+    status_img_shown = 0;
+}
+
+/*
+ * fill_palette
+ *   DESCRIPTION: Write a run of colors into the VGA palette.
+ *   INPUTS: first -- index of first palette color to write
+ *           count -- number of colors to write
+ *           rgb -- 6-bit RGB (red, green, blue) values for the colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes palette colors first through first + count - 1
+ */
+void
+fill_palette (unsigned char first, int count, unsigned char rgb[][3])
+{
+    /* Start writing at color first. */
+    OUTB (0x03C8, first);
+
+    /* Write the colors from the array. */
+    REP_OUTSB (0x03C9, rgb, count * 3);
+
+    /* Remember the colors written. */
+    (void)memcpy (dac_image[first], rgb, count * 3);
+    palette_writes += 1 + count * 3;
+}
+
+
+/*
+ * update_palette
+ *   DESCRIPTION: Load a whole VGA palette, writing only the runs of colors
+ *                that differ from those already loaded (or all 256 colors
+ *                if the loaded colors are not known).
+ *   INPUTS: rgb -- 6-bit RGB (red, green, blue) values for all 256 colors
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes palette colors
+ */
+void
+update_palette (unsigned char rgb[256][3])
+{
+    int first;	/* first color of a run of changed colors */
+    int end;	/* color after the run                    */
+
+    palette_updates++;
+    if (!dac_image_valid) {
+        fill_palette (0x00, 256, rgb);
+	dac_image_valid = 1;
+	return;
+    }
+
+    /*
+     * Each run costs one index write, so runs separated by unchanged
+     * colors are cheaper written separately than merged.
+     */
+    for (first = 0; first < 256; first = end) {
+	for (; first < 256 && 0 == memcmp (dac_image[first], rgb[first], 3);
+	     first++);
+	for (end = first; end < 256 && 
+	     0 != memcmp (dac_image[end], rgb[end], 3); end++);
+	if (first < end)
+	    fill_palette (first, end - first, rgb + first);
+    }
+}
+
+
+/*
+ * palette_stats
+ *   DESCRIPTION: Get counts of the work done loading the VGA palette.
+ *   INPUTS: none
+ *   OUTPUTS: updates -- number of calls to update_palette (one per room
+ *                       prepared for display)
+ *            writes -- number of writes to the palette ports by
+ *                      update_palette and fill_palette
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+palette_stats (unsigned int* updates, unsigned long* writes)
+{
+    *updates = palette_updates;
+    *writes = palette_writes;
+}
+
+/*
+ * copy_to_planes
+ *   DESCRIPTION: Split a row of pixels into the four mode X planes.
+ *                Pixel i of the row has x coordinate x + i and goes to
+ *                byte (x + i) / 4 of plane (x + i) % 4.  Rows that start
+ *                part way through a group of four pixels are handled one
+ *                pixel at a time up to the next group, after which (if
+ *                USE_SIMD_PLANAR is 1 and the processor has SSE2) 64
+ *                pixels are split at once, then four at a time.
+ *   INPUTS: plane -- the start of the row in each plane
+ *           x -- x coordinate of the first pixel (non-negative)
+ *           src -- the row of pixels
+ *           n -- the number of pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes n bytes among the planes
+ */
+static void
+copy_to_planes (unsigned char* const plane[4], int x, 
+		const unsigned char* src, int n)
+{
+#if (1 == USE_SIMD_PLANAR)
+    int done;	/* pixels split with SSE2 */
+#endif
+
+    /* Copy pixels up to the start of a group of four. */
+    for (; 0 != (x & 3) && 0 < n; x++, n--) {
+        plane[x & 3][x >> 2] = *src++;
+    }
+
+#if (1 == USE_SIMD_PLANAR)
+    if (64 <= n && __builtin_cpu_supports ("sse2")) {
+        done = copy_to_planes_sse2 (plane, x, src, n);
+	x += done;
+	src += done;
+	n -= done;
+    }
+#endif /* USE_SIMD_PLANAR */
+
+    /* Copy remaining groups of four pixels, then any left over. */
+    for (; 4 <= n; x += 4, n -= 4, src += 4) {
+        plane[0][x >> 2] = src[0];
+        plane[1][x >> 2] = src[1];
+        plane[2][x >> 2] = src[2];
+        plane[3][x >> 2] = src[3];
+    }
+    for (; 0 < n; x++, n--) {
+        plane[x & 3][x >> 2] = *src++;
+    }
+}
+
+
+#if (1 == USE_SIMD_PLANAR)
+/*
+ * copy_to_planes_sse2
+ *   DESCRIPTION: Split whole blocks of 64 pixels of a row into the four
+ *                mode X planes, storing 16 bytes in each plane per block
+ *                (see copy_to_planes).
+ *   INPUTS: plane -- the start of the row in each plane
+ *           x -- x coordinate of the first pixel (a multiple of four)
+ *           src -- the row of pixels
+ *           n -- the number of pixels in the row
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of pixels split (a multiple of 64)
+ *   SIDE EFFECTS: writes among the planes
+ */
+static int
+copy_to_planes_sse2 (unsigned char* const plane[4], int x, 
+		     const unsigned char* src, int n)
+{
+    __m128i v[4];	/* 64 pixels of the row   */
+    int     done;	/* pixels split           */
+    int     i;		/* loop index over planes */
+
+    for (done = 0; n - done >= 64; done += 64) {
+	for (i = 0; i < 4; i++) {
+	    v[i] = _mm_loadu_si128 ((const __m128i*)(src + done + 16 * i));
+	}
+	for (i = 0; i < 4; i++) {
+	    _mm_storeu_si128 ((__m128i*)(plane[i] + ((x + done) >> 2)), 
+			      plane_bytes (v, i));
+	}
+    }
+    return done;
 }
 
+
+/*
+ * plane_bytes
+ *   DESCRIPTION: Pick out the pixels of one plane from 64 pixels that
+ *                start a group of four (see copy_to_planes).  Each 32-bit
+ *                lane holds a group; the plane's byte is shifted down and
+ *                masked, then the lanes are packed to bytes.
+ *   INPUTS: v -- the 64 pixels
+ *           p -- the plane (0 to 3)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the 16 pixels in plane p, in order
+ *   SIDE EFFECTS: none
+ */
+static __m128i
+plane_bytes (const __m128i v[4], int p)
+{
+    const __m128i mask = _mm_set1_epi32 (0xFF);
+    __m128i       lo;	/* pixels 0 to 31, as 16-bit values  */
+    __m128i       hi;	/* pixels 32 to 63, as 16-bit values */
+
+    lo = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (v[0], 8 * p), mask),
+			  _mm_and_si128 (_mm_srli_epi32 (v[1], 8 * p), mask));
+    hi = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (v[2], 8 * p), mask),
+			  _mm_and_si128 (_mm_srli_epi32 (v[3], 8 * p), mask));
+    return _mm_packus_epi16 (lo, hi);
+}
+#endif /* USE_SIMD_PLANAR */
+
+
 /*
  * create_status_bar
- *   DESCRIPTION: Draws status bar to screen (uses copy_status_bar and textToGraphics functions
+ *   DESCRIPTION: Draws status bar to screen (uses copy_status_bar and textToGraphics functions),
+ *                unless it already shows the same strings (see status_img)
  *   INPUTS: room - pointer to room; status - pointer to status; input_text - pointer to command line text
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Draws status bar to screen
+ *   SIDE EFFECTS: Draws status bar to screen; remembers the strings drawn
  */
 
 void create_status_bar(const char* room, const char* status, const char* input_text)
 {
 	int i;
 	const char * underscore = "_";
-	unsigned char buf[4*STAT_BAR_SIZE];
-	//Loops to fill the buffer with the color dark blue (2). (background color of the status bar).
-	for (i=0;i<(4*STAT_BAR_SIZE);i++)
-		buf[i] = BACKGROUND_COLOR;
+	const char * text[3];                              //strings to be shown
+	unsigned char image[STAT_BAR_ROWS*STAT_BAR_WIDTH]; //status bar, one row after another
+	unsigned char* plane[4];                           //start of each plane in status_img
+
+	//nothing to draw if the status bar already shows these strings
+	text[0] = room;
+	text[1] = status;
+	text[2] = input_text;
+	if (status_img_valid) {
+		for (i = 0; i < 3 && strcmp(text[i], status_text[i]) == 0; i++);
+		if (i == 3) {
+			if (!status_img_shown)
+				show_status_img();
+			return;
+		}
+	}
+
+	//Fill the image with the color dark blue (2). (background color of the status bar).
+	memset(image, BACKGROUND_COLOR, sizeof(image));
 	//checks to see if there is a status present, and if so, prints it to status bar
 	if (status[0]!='\0'){
-		textToGraphics(buf, status, 1);
+		textToGraphics(image, status, 1);
 	}
 	//if no status, print the room name and anything typed to status bar
 	else{
-		textToGraphics(buf, room, 0);
+		textToGraphics(image, room, 0);
 		//if length of typed text is less than 20 add underscore to end
 		//to make it look more like demo
 		if(strlen(input_text) < 20) {
-			textToGraphics(buf, underscore, 2);
-			textToGraphics(buf, input_text, 3);
+			textToGraphics(image, underscore, 2);
+			textToGraphics(image, input_text, 3);
 
 		}
 		//accounts for 20th character to make underscore disappear
 		else{
-			textToGraphics(buf, input_text, 2);
+			textToGraphics(image, input_text, 2);
 		}
 	}
 
-	/* draw to each plane in the video memory. */
-	//taken from show_screen and modified
+	//split the image into planes; the rows of each plane follow one another, so the whole
+	//image can be split at once
+	for (i = 0; i < 4; i++)
+		plane[i] = status_img + i*STAT_BAR_SIZE;
+	copy_to_planes(plane, 0, image, sizeof(image));
+
+	//remember the strings drawn, if they fit
+	status_img_valid = 1;
+	for (i = 0; i < 3; i++) {
+		if (strlen(text[i]) > STAT_BAR_TEXT_LEN)
+			status_img_valid = 0;
+		else
+			strcpy(status_text[i], text[i]);
+	}
+	show_status_img();
+}
+
+
+/*
+ * show_status_img
+ *   DESCRIPTION: Copy the status bar image into video memory.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws status bar to screen
+ */
+static void
+show_status_img ()
+{
+    int i; /* loop index over video planes */
+
+    /* Draw to each plane in the video memory. */
     for (i = 0; i < 4; i++) {
-		SET_WRITE_MASK (1 << (i + 8));
-		copy_status_bar(buf + i*STAT_BAR_SIZE,0x0000);
+	SET_WRITE_MASK (1 << (i + 8));
+	copy_status_bar (status_img + i * STAT_BAR_SIZE, 0x0000);
     }
-
+    status_img_shown = 1;
 }
 
 
@@ -613,47 +986,162 @@ void create_status_bar(const char* room, const char* status, const char* input_t
 
 
 /*
- * draw_vert_line
- *   DESCRIPTION: Draw a vertical map line into the build buffer.  The
- *                line should be offset from the left side of the logical
- *                view window screen by the given number of pixels.
- *   INPUTS: x -- the 0-based pixel column number of the line to be drawn
- *                within the logical view window (equivalent to the number
- *                of pixels from the leftmost pixel to the line to be
- *                drawn)
+ * fill_rect_from_lines
+ *   DESCRIPTION: Produce the image of a logical rectangle from images of
+ *                lines, for callers of set_mode_X that do not provide a
+ *                rectangle callback.  The rectangle must lie within the
+ *                logical view window.  Rectangles of whole columns are
+ *                built from vertical lines, others from horizontal lines.
+ *   INPUTS: (x,y) -- upper left pixel of the rectangle
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: buf -- image of the rectangle (w * h pixels, top row first)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_rect_from_lines (int x, int y, int w, int h, unsigned char* buf)
+{
+    unsigned char line[SCROLL_X_DIM]; /* image of one line      */
+    int i;			      /* loop index over lines  */
+    int j;			      /* loop index over pixels */
+
+    if (w == SCROLL_X_DIM) {
+	for (i = 0; i < h; i++) {
+	    (*horiz_line_fn) (x, y + i, buf + i * w);
+	}
+    } else if (h != SCROLL_Y_DIM) {
+	for (i = 0; i < h; i++) {
+	    (*horiz_line_fn) (x, y + i, line);
+	    memcpy (buf + i * w, line, w);
+	}
+    } else {
+	for (i = 0; i < w; i++) {
+	    (*vert_line_fn) (x + i, y, line);
+	    for (j = 0; j < h; j++) {
+		buf[j * w + i] = line[j];
+	    }
+	}
+    }
+}
+
+
+/*
+ * draw_vert_block
+ *   DESCRIPTION: Draw one or more adjacent vertical map lines into the
+ *                build buffer, obtaining their image with one call to the
+ *                rectangle callback.  The block should be offset from the
+ *                left side of the logical view window screen by the given
+ *                number of pixels.
+ *   INPUTS: x -- the 0-based pixel column number of the first line to be
+ *                drawn within the logical view window
+ *           n -- the number of lines to be drawn
  *   OUTPUTS: none
- *   RETURN VALUE: Returns 0 on success.  If x is outside of the valid
- *                 SCROLL range, the function returns -1.
+ *   RETURN VALUE: Returns 0 on success.  If any line is outside of the
+ *                 valid SCROLL range, the function returns -1.
  *   SIDE EFFECTS: draws into the build buffer
  */
 int
-draw_vert_line (int x)
+draw_vert_block (int x, int n)
 {
-    unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
+    unsigned char* plane;            /* build buffer plane of the line     */
+    int off;			     /* ring offset of pixel in the plane  */
+    int col;			     /* loop index over lines              */
     int i;			     /* loop index over pixels             */
 
-    /* Check whether requested line falls in the logical view window. */
-    if (x < 0 || x >= SCROLL_X_DIM)
+    /* Check whether requested lines fall in the logical view window. */
+    if (x < 0 || n < 1 || x + n > SCROLL_X_DIM)
 	return -1;
 
     /* Adjust x to the logical column value. */
     x += show_x;
 
-    /* Get the image of the line. */
-    (*vert_line_fn) (x, show_y, buf);
+    /* Get the image of the lines. */
+    (*rect_fn) (x, show_y, n, SCROLL_Y_DIM, block);
+    mark_rows_changed (0, SCROLL_Y_DIM);
+
+    for (col = 0; col < n; col++) {
+	/* Calculate plane and starting offset in build buffer. */
+	plane = BUILD_PLANE ((x + col) & 3);
+	off = BUILD_RING_OFF (x + col, show_y);
+
+	/* 
+	 * Copy image data into the plane in the build buffer, wrapping
+	 * around the end of the plane's ring.
+	 */
+	for (i = 0; i < SCROLL_Y_DIM; i++) {
+	    plane[off] = block[i * n + col];
+	    if (SCROLL_SIZE <= (off += SCROLL_X_WIDTH))
+	        off -= SCROLL_SIZE;
+	}
+    }
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH;
+    /* Return success. */
+    return 0;
+}
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (x & 3));
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-        addr[i * SCROLL_X_WIDTH + p_off * SCROLL_SIZE] = buf[i];
+/*
+ * draw_block
+ *   DESCRIPTION: Draw a rectangle of the map into the build buffer,
+ *                obtaining its image with one call to the rectangle
+ *                callback.  The rectangle is given relative to the upper
+ *                left corner of the logical view window screen.
+ *   INPUTS: (x,y) -- the 0-based pixel column and row of the upper left
+ *                    pixel of the rectangle within the logical view window
+ *           (w,h) -- the width and height of the rectangle
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If any pixel is outside of the
+ *                 valid SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+int
+draw_block (int x, int y, int w, int h)
+{
+    unsigned char* plane[4];         /* start of row in each plane         */
+    int off;			     /* ring offset of row in the planes   */
+    int n;			     /* pixels before the end of the ring  */
+    int row;			     /* loop index over lines              */
+    int i;			     /* loop index over planes             */
+
+    /* Check whether the rectangle falls in the logical view window. */
+    if (x < 0 || y < 0 || w < 1 || h < 1 ||
+        x + w > SCROLL_X_DIM || y + h > SCROLL_Y_DIM)
+	return -1;
+
+    /* Adjust x and y to the logical column and row values. */
+    x += show_x;
+    y += show_y;
+
+    /* Get the image of the rectangle. */
+    (*rect_fn) (x, y, w, h, block);
+    mark_rows_changed (y - show_y, h);
+
+    for (row = 0; row < h; row++) {
+	/* 
+	 * Calculate starting address of row in each plane of the build
+	 * buffer.  The row is then addressed from pixel x & 3.
+	 */
+	off = BUILD_RING_OFF (x, y + row);
+	for (i = 0; i < 4; i++) {
+	    plane[i] = BUILD_PLANE (i) + off;
+	}
+
+	/* 
+	 * Copy image data into appropriate planes in build buffer.  If
+	 * the row wraps around the end of the planes' rings, the rest of
+	 * the row (starting at a multiple of four pixels) goes at the
+	 * start of the rings.
+	 */
+	n = 4 * (SCROLL_SIZE - off) - (x & 3);
+	if (w <= n) {
+	    copy_to_planes (plane, x & 3, block + row * w, w);
+	} else {
+	    copy_to_planes (plane, x & 3, block + row * w, n);
+	    for (i = 0; i < 4; i++) {
+		plane[i] = BUILD_PLANE (i);
+	    }
+	    copy_to_planes (plane, 0, block + row * w + n, w - n);
+	}
     }
 
     /* Return success. */
@@ -661,11 +1149,55 @@ draw_vert_line (int x)
 }
 
 
+/*
+ * draw_horiz_block
+ *   DESCRIPTION: Draw one or more adjacent horizontal map lines into the
+ *                build buffer (see draw_block).  The block should be
+ *                offset from the top of the logical view window screen by
+ *                the given number of pixels.
+ *   INPUTS: y -- the 0-based pixel row number of the first line to be
+ *                drawn within the logical view window
+ *           n -- the number of lines to be drawn
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If any line is outside of the
+ *                 valid SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+int
+draw_horiz_block (int y, int n)
+{
+    return draw_block (0, y, SCROLL_X_DIM, n);
+}
+
+
+/*
+ * draw_vert_line
+ *   DESCRIPTION: Draw a vertical map line into the build buffer.  The
+ *                line should be offset from the left side of the logical
+ *                view window screen by the given number of pixels.  Same
+ *                as a block of one line (see draw_vert_block).
+ *   INPUTS: x -- the 0-based pixel column number of the line to be drawn
+ *                within the logical view window (equivalent to the number
+ *                of pixels from the leftmost pixel to the line to be
+ *                drawn)
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If x is outside of the valid
+ *                 SCROLL range, the function returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+int
+draw_vert_line (int x)
+{
+    return draw_vert_block (x, 1);
+}
+
+
 /*
  * draw_horiz_line
  *   DESCRIPTION: Draw a horizontal map line into the build buffer.  The
  *                line should be offset from the top of the logical view
- *                window screen by the given number of pixels.
+ *                window screen by the given number of pixels.  Same as a
+ *                block of one line (see draw_horiz_block).
  *   INPUTS: y -- the 0-based pixel row number of the line to be drawn
  *                within the logical view window (equivalent to the number
  *                of pixels from the top pixel to the line to be drawn)
@@ -677,38 +1209,59 @@ draw_vert_line (int x)
 int
 draw_horiz_line (int y)
 {
-    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
-
-    /* Check whether requested line falls in the logical view window. */
-    if (y < 0 || y >= SCROLL_Y_DIM)
-	return -1;
-
-    /* Adjust y to the logical row value. */
-    y += show_y;
-
-    /* Get the image of the line. */
-    (*horiz_line_fn) (show_x, y, buf);
+    return draw_horiz_block (y, 1);
+}
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+/*
+ * make_view_image
+ *   DESCRIPTION: Split an image of the whole logical view window into
+ *                planes, laid out as the build buffer holds them when
+ *                the window is at (0,0), so that show_view_image can
+ *                later put the image in the build buffer with one copy.
+ *                Uses no state, so images can be made by any thread.
+ *   INPUTS: pixels -- the image, SCROLL_Y_DIM rows of SCROLL_X_DIM pixels,
+ *                     top row first
+ *   OUTPUTS: img -- the image split into planes (VIEW_IMAGE_SIZE bytes)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+make_view_image (const unsigned char* pixels, unsigned char* img)
+{
+    unsigned char* plane[4]; /* start of row in each plane */
+    int row;		     /* loop index over lines      */
+    int i;		     /* loop index over planes     */
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-	if (--p_off < 0) {
-	    p_off = 3;
-	    addr++;
+    for (row = 0; row < SCROLL_Y_DIM; row++) {
+	for (i = 0; i < 4; i++) {
+	    plane[i] = img + i * SCROLL_SIZE + row * SCROLL_X_WIDTH;
 	}
+	copy_to_planes (plane, 0, pixels + row * SCROLL_X_DIM, SCROLL_X_DIM);
     }
+}
 
-    /* Return success. */
+
+/*
+ * show_view_image
+ *   DESCRIPTION: Put an image made by make_view_image into the build
+ *                buffer, replacing the whole logical view window, which
+ *                must be at (0,0).
+ *   INPUTS: img -- the image split into planes
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success, or -1 if the logical view window
+ *                 is not at (0,0).
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+int
+show_view_image (const unsigned char* img)
+{
+    if (0 != show_x || 0 != show_y)
+        return -1;
+
+    /* At (0,0), the window starts each plane's ring. */
+    (void)memcpy (BUILD_PLANE (0), img, SCREEN_SIZE);
+    mark_rows_changed (0, SCROLL_Y_DIM);
     return 0;
 }
 
@@ -727,6 +1280,15 @@ draw_horiz_line (int y)
 static int
 open_memory_and_ports ()
 {
+#if (1 == VGA_EMULATION)
+    /*
+     * Nothing to map: reset the software VGA and use its host memory
+     * window in place of video memory.
+     */
+    vga_emu_init ();
+    mem_image = vga_emu_window ();
+    return 0;
+#else /* (0 == VGA_EMULATION) */
     int mem_fd;  /* file descriptor for physical memory image */
 
     /* Obtain permission to access ports 0x03C0 through 0x03DA. */
@@ -751,6 +1313,7 @@ open_memory_and_ports ()
     /* Close /dev/mem file descriptor and return success. */
     (void)close (mem_fd);
     return 0;
+#endif /* VGA_EMULATION */
 }
 
 
@@ -771,6 +1334,17 @@ VGA_blank (int blank_bit)
      */
     blank_bit = ((blank_bit & 1) << 5);
 
+#if (1 == VGA_EMULATION)
+    {
+	unsigned char val; /* sequencer clocking mode register */
+
+	vga_emu_outb (0x03C4, 0x01);
+	val = (vga_emu_inb (0x03C5) & 0xDF) | blank_bit;
+	vga_emu_outb (0x03C5, val);
+	(void)vga_emu_inb (0x03DA);
+	vga_emu_outb (0x03C0, 0x20);
+    }
+#else /* (0 == VGA_EMULATION) */
     asm volatile (
 	"movb $0x01,%%al         /* Set sequencer index to 1. */       ;"
 	"movw $0x03C4,%%dx                                             ;"
@@ -786,6 +1360,7 @@ VGA_blank (int blank_bit)
 	"movb $0x20,%%al                                               ;"
 	"outb %%al,(%%dx)                                               "
       : : "g" (blank_bit) : "eax", "edx", "memory");
+#endif /* VGA_EMULATION */
 }
 
 
@@ -853,9 +1428,13 @@ static void
 set_attr_registers (unsigned char table[NUM_ATTR_REGS * 2])
 {
     /* Reset attribute register to write index next rather than data. */
+#if (1 == VGA_EMULATION)
+    (void)vga_emu_inb (0x03DA);
+#else
     asm volatile (
 	"inb (%%dx),%%al"
       : : "d" (0x03DA) : "eax", "memory");
+#endif
     REP_OUTSB (0x03C0, table, NUM_ATTR_REGS * 2);
 }
 
@@ -929,6 +1508,7 @@ fill_palette_mode_x ()
 
     /* Write all 64 colors from array. */
     REP_OUTSB (0x03C9, palette_RGB, 64 * 3);
+    dac_image_valid = 0;
 }
 
 
@@ -969,6 +1549,7 @@ fill_palette_text ()
 
     /* Write all 32 colors from array. */
     REP_OUTSB (0x03C9, palette_RGB, 32 * 3);
+    dac_image_valid = 0;
 }
 
 
@@ -1022,7 +1603,7 @@ write_font_data ()
 static void
 set_text_mode_3 (int clear_scr)
 {
-    unsigned long* txt_scr; /* pointer to text screens in video memory */
+    unsigned int* txt_scr;  /* pointer to text screens in video memory */
     int i;                  /* loop over text screen words             */
 
     VGA_blank (1);                               /* blank the screen        */
@@ -1037,7 +1618,7 @@ set_text_mode_3 (int clear_scr)
     set_graphics_registers (text_graphics);      /* graphics registers      */
     fill_palette_text ();			 /* palette colors          */
     if (clear_scr) {				 /* clear screens if needed */
-	txt_scr = (unsigned long*)(mem_image + 0x18000);
+	txt_scr = (unsigned int*)(mem_image + 0x18000);
 	for (i = 0; i < 8192; i++)
 	    *txt_scr++ = 0x07200720;
     }
@@ -1048,17 +1629,23 @@ set_text_mode_3 (int clear_scr)
 
 /*
  * copy_image
- *   DESCRIPTION: Copy one plane of a screen from the build buffer to the
- *                video memory.
- *   INPUTS: img -- a pointer to a single screen plane in the build buffer
+ *   DESCRIPTION: Copy rows of one plane of a screen from the build buffer
+ *                to the video memory.
+ *   INPUTS: img -- a pointer to the first row in a single screen plane in
+ *                  the build buffer
  *           scr_addr -- the destination offset in video memory
+ *           n -- the number of bytes to copy
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: copies a plane from the build buffer to video memory
+ *   SIDE EFFECTS: copies part of a plane from the build buffer to video
+ *                 memory
  */
 static void
-copy_image (unsigned char* img, unsigned short scr_addr)
+copy_image (unsigned char* img, unsigned short scr_addr, int n)
 {
+#if (1 == VGA_EMULATION)
+    vga_emu_write (scr_addr, img, n);
+#else /* (0 == VGA_EMULATION) */
     /*
      * memcpy is actually probably good enough here, and is usually
      * implemented using ISA-specific features like those below,
@@ -1066,12 +1653,13 @@ copy_image (unsigned char* img, unsigned short scr_addr)
      */
     asm volatile (
         "cld                                                 ;"
-       	"movl $16000,%%ecx                                   ;"
+       	"movl %2,%%ecx                                       ;"
        	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
       : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr)
+      : "S" (img), "D" (mem_image + scr_addr), "r" (n)
       : "eax", "ecx", "memory"
     );
+#endif /* VGA_EMULATION */
 }
 
 /*
@@ -1086,6 +1674,9 @@ copy_image (unsigned char* img, unsigned short scr_addr)
  */
 static void
 copy_status_bar (unsigned char* img, unsigned short scr_addr) {
+#if (1 == VGA_EMULATION)
+    vga_emu_write (scr_addr, img, STAT_BAR_SIZE);
+#else /* (0 == VGA_EMULATION) */
 	/*
      * memcpy is actually probably good enough here, and is usually
      * implemented using ISA-specific features like those below,
@@ -1100,7 +1691,7 @@ copy_status_bar (unsigned char* img, unsigned short scr_addr) {
       : "S" (img), "D" (mem_image + scr_addr)
       : "eax", "ecx", "memory"
     );
-
+#endif /* VGA_EMULATION */
 }
 
 
@@ -1127,8 +1718,10 @@ main ()
     /* Put VGA into text mode without clearing the screen. */
     set_text_mode_3 (0);
 
+#if (0 == VGA_EMULATION)
     /* Unmap video memory. */
     (void)munmap (mem_image, VID_MEM_SIZE);
+#endif
 
     /* Return success. */
     return 0;
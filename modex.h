@@ -112,11 +112,17 @@
  * is drawn.  Other data are left untouched in most cases.
  */
 
-/* configure VGA for mode X; initializes logical view to (0,0) */
+/* 
+ * configure VGA for mode X; initializes logical view to (0,0); lines and
+ * blocks are drawn with images from rect_fill_fn (x, y, width, height,
+ * buffer), or, if it is NULL, from the line functions
+ */
 extern int set_mode_X (void (*horiz_fill_fn)
                             (int, int, unsigned char[SCROLL_X_DIM]),
 		       void (*vert_fill_fn)
-		            (int, int, unsigned char[SCROLL_Y_DIM]));
+		            (int, int, unsigned char[SCROLL_Y_DIM]),
+		       void (*rect_fill_fn)
+			    (int, int, int, int, unsigned char*));
 
 /* return to text mode */
 extern void clear_mode_X ();
@@ -127,9 +133,23 @@ extern void set_view_window (int scr_x, int scr_y);
 /* show the logical view window on the monitor */
 extern void show_screen ();
 
+/* get counts of screens shown and skipped and bytes copied by show_screen */
+extern void show_screen_stats (unsigned int* shown, unsigned int* skipped,
+			       unsigned long* bytes);
+
 /* clear the video memory in mode X */
 extern void clear_screens ();
 
+/* write count palette colors (6-bit RGB) starting at color first */
+extern void fill_palette (unsigned char first, int count,
+			  unsigned char rgb[][3]);
+
+/* load all 256 palette colors, writing only those that have changed */
+extern void update_palette (unsigned char rgb[256][3]);
+
+/* get counts of palette loads and palette port writes */
+extern void palette_stats (unsigned int* updates, unsigned long* writes);
+
 /*create a status bar on the bottom of the screen*/
 extern void create_status_bar(const char * room, const char * status, const char * input_text);
 
@@ -139,4 +159,22 @@ extern int draw_horiz_line (int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line (int x);
 
+/* draw n horizontal lines starting at vertical pixel y within the view */
+extern int draw_horiz_block (int y, int n);
+
+/* draw n vertical lines starting at horizontal pixel x within the view */
+extern int draw_vert_block (int x, int n);
+
+/* draw a w by h rectangle with upper left pixel (x,y) within the view */
+extern int draw_block (int x, int y, int w, int h);
+
+/* bytes in an image of the view split into planes (see make_view_image) */
+#define VIEW_IMAGE_SIZE (SCROLL_X_WIDTH * SCROLL_Y_DIM * 4)
+
+/* split an image of the whole view (at (0,0)) into planes */
+extern void make_view_image (const unsigned char* pixels, unsigned char* img);
+
+/* replace the view, which must be at (0,0), with an image split into planes */
+extern int show_view_image (const unsigned char* img);
+
 #endif /* MODEX_H */
@@ -45,6 +45,10 @@
  * The output file format is 5:6:5 RGB stored in the same order as in the
  * BMP, i.e., rows from bottom to top, and from right to left within each
  * row.  The header simply gives the dimensions of the image.
+ *
+ * Compiled with WRITE_COMPRESSED_PHOTO set to 1 (as mp2zphoto), the
+ * program writes compressed room photos instead (see photo_headers.h),
+ * and also accepts an existing room photo as input.
  */
 
 
@@ -59,6 +63,12 @@
 #if !defined(WRITE_OBJECT_IMAGE)
 #define WRITE_OBJECT_IMAGE 0		/* output defaults to room photo */
 #endif
+#if !defined(WRITE_COMPRESSED_PHOTO)
+#define WRITE_COMPRESSED_PHOTO 0	/* room photos default to raw    */
+#endif
+#if (1 == WRITE_OBJECT_IMAGE && 1 == WRITE_COMPRESSED_PHOTO)
+#error "object images cannot be compressed"
+#endif
 
 
 /* 
@@ -127,16 +137,147 @@ read_bmp_image_data (FILE* in, const bmp_header_t* h)
     return img_data;
 }
 
-// Write header and data as either 5:6:5 RGB words (little endian) or
-// 2:2:2 RGB bytes, row by row, to the output file.  Return 1 on success, 
-// 0 on failure.
+#if (1 == WRITE_COMPRESSED_PHOTO)
+// Code one row of 5:6:5 pixels as described in photo_headers.h and write
+// the codes to the output file.  Return 1 on success, 0 on failure.
 static int
-write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
+write_compressed_row (FILE* out, const uint16_t* row, uint32_t width)
+{
+    static uint8_t code[3 * 4096];
+    uint32_t       len = 0;
+    uint16_t       prev = 0;
+    uint32_t       x;
+    uint32_t       n;
+    int32_t        dr;
+    int32_t        dg;
+    int32_t        db;
+
+    for (x = 0; width > x; x++) {
+	// Repeats of the previous pixel become one run code.
+	if (row[x] == prev) {
+	    for (n = 1; PHOTO_Z_MAX_RUN > n && width > x + n &&
+			row[x + n] == prev; n++) {
+	    }
+	    code[len++] = PHOTO_Z_RUN | (n - 1);
+	    x += n - 1;
+	    continue;
+	}
+
+	// Otherwise, code the change from the previous pixel if it is
+	// small enough, or else the whole pixel.
+	dr = (row[x] >> 11) - (prev >> 11);
+	dg = ((row[x] >> 5) & 0x3F) - ((prev >> 5) & 0x3F);
+	db = (row[x] & 0x1F) - (prev & 0x1F);
+	if (-PHOTO_Z_SMALL_R <= dr && PHOTO_Z_SMALL_R > dr &&
+	    -PHOTO_Z_SMALL_G <= dg && PHOTO_Z_SMALL_G > dg &&
+	    -PHOTO_Z_SMALL_B <= db && PHOTO_Z_SMALL_B > db) {
+	    code[len++] = ((dr + PHOTO_Z_SMALL_R) << 5) |
+			  ((dg + PHOTO_Z_SMALL_G) << 2) | (db + PHOTO_Z_SMALL_B);
+	} else if (-PHOTO_Z_LARGE_R <= dr && PHOTO_Z_LARGE_R > dr &&
+		   -PHOTO_Z_LARGE_G <= dg && PHOTO_Z_LARGE_G > dg &&
+		   -PHOTO_Z_LARGE_B <= db && PHOTO_Z_LARGE_B > db) {
+	    code[len++] = PHOTO_Z_LARGE | ((dr + PHOTO_Z_LARGE_R) << 2) |
+			  ((dg + PHOTO_Z_LARGE_G) >> 4);
+	    code[len++] = (((dg + PHOTO_Z_LARGE_G) & 0xF) << 4) |
+			  (db + PHOTO_Z_LARGE_B);
+	} else {
+	    code[len++] = PHOTO_Z_WHOLE;
+	    code[len++] = row[x] & 0xFF;
+	    code[len++] = row[x] >> 8;
+	}
+	prev = row[x];
+    }
+    if (len != fwrite (code, 1, len, out)) {
+        perror ("write data to output file");
+	return 0;
+    }
+    return 1;
+}
+
+// Write the header of a compressed room photo to the output file.  Return
+// 1 on success, 0 on failure.
+static int
+write_compressed_header (FILE* out, uint16_t width, uint16_t height)
+{
+    photo_z_header_t z_header;
+
+    z_header.magic = PHOTO_Z_MAGIC;
+    z_header.hdr.width = width;
+    z_header.hdr.height = height;
+    if (1 != fwrite (&z_header, sizeof (z_header), 1, out)) {
+        perror ("write header to output file");
+	return 0;
+    }
+    return 1;
+}
+
+// Check whether the input file starts like a BMP file, leaving the file
+// position at the start.
+static int
+is_bmp_file (FILE* in)
+{
+    char magic[3];
+    int  is_bmp;
+
+    magic[2] = '\0';
+    is_bmp = (2 == fread (magic, sizeof (magic[0]), 2, in) &&
+	      0 == strcmp (magic, BMP_MAGIC));
+    rewind (in);
+    return is_bmp;
+}
+
+// Compress an existing room photo, one row at a time.  Return 0 on
+// success, 2 if the input is not a room photo, or 3 if the output cannot
+// be written.
+static int
+compress_room_photo (const char* fname, FILE* in, FILE* out)
 {
     photo_header_t photo_header;
+    static uint16_t row[UINT16_MAX];
+    uint16_t	   y;
+
+    if (1 != fread (&photo_header, sizeof (photo_header), 1, in)) {
+        fprintf (stderr, "%s is neither a BMP file nor a room photo.\n",
+		 fname);
+	return 2;
+    }
+    if (!write_compressed_header (out, photo_header.width, 
+				  photo_header.height)) {
+	return 3;
+    }
+    for (y = 0; photo_header.height > y; y++) {
+	if (photo_header.width != fread (row, sizeof (row[0]), 
+					 photo_header.width, in)) {
+	    fprintf (stderr, "%s is neither a BMP file nor a room photo.\n",
+		     fname);
+	    return 2;
+	}
+	if (!write_compressed_row (out, row, photo_header.width)) {
+	    return 3;
+	}
+    }
+    return 0;
+}
+#endif /* WRITE_COMPRESSED_PHOTO */
+
+// Write header and data as either 5:6:5 RGB words (little endian),
+// compressed 5:6:5 RGB rows, or 2:2:2 RGB bytes, row by row, to the 
+// output file.  Return 1 on success, 0 on failure.
+static int
+write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
+{
     uint32_t       row_width;
     uint16_t	   x;
     uint16_t	   y;
+#if (1 == WRITE_COMPRESSED_PHOTO)
+    static uint16_t row[4096];
+
+    // Write header to output file.
+    if (!write_compressed_header (out, h->img_width, h->img_height)) {
+	return 0;
+    }
+#else /* (1 != WRITE_COMPRESSED_PHOTO) */
+    photo_header_t photo_header;
 
     // Write header to output file.
     photo_header.width = h->img_width;
@@ -145,6 +286,7 @@ write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
         perror ("write header to output file");
 	return 0;
     }
+#endif /* WRITE_COMPRESSED_PHOTO */
 
     // Write image data to output file.
     row_width = bmp_row_width (h);
@@ -169,11 +311,20 @@ write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
 	    		((img[row_width * y + 3 * x + 1] >> 2) << 5) | 
 			(img[row_width * y + 3 * x] >> 3);
 #endif /* WRITE_OBJECT_IMAGE */
+#if (1 == WRITE_COMPRESSED_PHOTO)
+	    row[x] = vga_color;
+#else /* (1 != WRITE_COMPRESSED_PHOTO) */
 	    if (1 != fwrite (&vga_color, sizeof (vga_color), 1, out)) {
 	        perror ("write data to output file");
 		return 0;
 	    }
+#endif /* WRITE_COMPRESSED_PHOTO */
+	}
+#if (1 == WRITE_COMPRESSED_PHOTO)
+	if (!write_compressed_row (out, row, h->img_width)) {
+	    return 0;
 	}
+#endif /* WRITE_COMPRESSED_PHOTO */
     }
 
     return 1;
@@ -205,6 +356,19 @@ main (int argc, char* argv[])
 	return 2;
     }
 
+#if (1 == WRITE_COMPRESSED_PHOTO)
+    // A room photo (rather than a BMP file) is simply compressed.
+    if (!is_bmp_file (in)) {
+	written = compress_room_photo (argv[1], in, out);
+	(void)fclose (in);
+	if (EOF == fclose (out)) {
+	    perror ("close output file");
+	    written = 3;
+	}
+	return written;
+    }
+#endif /* WRITE_COMPRESSED_PHOTO */
+
     // Check validity of input file, then read image data from input file.
     if (!bmp_header_check (argv[1], in, &bmp_header) ||
 	NULL == (img_data = read_bmp_image_data (in, &bmp_header))) {
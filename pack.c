@@ -0,0 +1,252 @@
+/*									tab:8
+ *
+ * pack.c - asset pack lookup
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    pack.c
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pack.h"
+#include "photo.h"
+
+
+/* local functions--see function headers for details */
+static int32_t check_entry (const pack_entry_t* e, size_t len);
+static int compare_entry (const void* key, const void* elt);
+static void leave_unopened ();
+static void open_pack ();
+
+
+/* file-scope variables */
+
+static pthread_once_t       pack_once = PTHREAD_ONCE_INIT; /* mapped yet? */
+static const uint8_t*       pack_map = NULL;   /* mapped pack, or NULL  */
+static const pack_header_t* pack_hdr = NULL;   /* header of mapped pack */
+static const pack_entry_t*  pack_index = NULL; /* index of mapped pack  */
+
+
+/*
+ * check_entry
+ *   DESCRIPTION: Check that an index entry is well formed and that its
+ *                palette and pixel data lie within the pack.
+ *   INPUTS: e -- the entry
+ *           len -- length of the pack in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the entry is good, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+check_entry (const pack_entry_t* e, size_t len)
+{
+    size_t size;	/* bytes of pixel data */
+
+    if (NULL == memchr (e->name, '\0', sizeof (e->name))) {
+        return 0;
+    }
+    size = (size_t)e->hdr.width * e->hdr.height;
+    switch (e->kind) {
+	case PACK_OBJECT:
+	    break;
+	case PACK_PHOTO:
+	    size = PHOTO_TILED_SIZE ((size_t)e->hdr.width, e->hdr.height);
+	    if (e->palette > len || 192 * 3 > len - e->palette) {
+		return 0;
+	    }
+	    break;
+	case PACK_PHOTO_RAW:
+	    size *= sizeof (uint16_t);
+	    break;
+	default:
+	    return 0;
+    }
+    return (e->pixels <= len && size <= len - e->pixels);
+}
+
+
+/*
+ * open_pack
+ *   DESCRIPTION: Map the asset pack and check its header and index.  A
+ *                missing pack is silently ignored; a bad one is reported
+ *                and ignored.  Called once, through pack_once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: maps the pack for the life of the program
+ */
+static void
+open_pack ()
+{
+    int                  fd;	/* pack file descriptor   */
+    struct stat          st;	/* pack file status       */
+    void*                map;	/* mapped pack            */
+    const pack_header_t* hdr;	/* header of pack         */
+    const pack_entry_t*  index;	/* index of pack          */
+    uint32_t             idx;	/* index over entries     */
+    int32_t              good;	/* pack is well formed?   */
+
+    if (-1 == (fd = open (ASSET_PACK, O_RDONLY))) {
+	if (ENOENT != errno) {
+	    perror ("open asset pack");
+	}
+	return;
+    }
+    if (0 != fstat (fd, &st) || sizeof (*hdr) > (size_t)st.st_size ||
+	MAP_FAILED == (map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED,
+				   fd, 0))) {
+	(void)close (fd);
+	fprintf (stderr, "%s: cannot map asset pack\n", ASSET_PACK);
+	return;
+    }
+    (void)close (fd);
+
+    /* Check the header, then every entry of the index. */
+    hdr = map;
+    index = (const pack_entry_t*)(hdr + 1);
+    good = (PACK_MAGIC == hdr->magic && PACK_VERSION == hdr->version &&
+	    (st.st_size - sizeof (*hdr)) / sizeof (*index) >= hdr->n_entries);
+    for (idx = 0; good && hdr->n_entries > idx; idx++) {
+	good = (check_entry (&index[idx], st.st_size) &&
+		(0 == idx ||
+		 0 > strcmp (index[idx - 1].name, index[idx].name)));
+    }
+    if (!good) {
+	fprintf (stderr, "%s: bad asset pack (rebuild with mkpack)\n",
+		 ASSET_PACK);
+	(void)munmap (map, st.st_size);
+	return;
+    }
+    pack_map = map;
+    pack_hdr = hdr;
+    pack_index = index;
+}
+
+
+/*
+ * compare_entry
+ *   DESCRIPTION: Compare an asset name with an index entry (for bsearch).
+ *   INPUTS: key -- the name (const char*)
+ *           elt -- the entry (const pack_entry_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative, zero, or positive as the name sorts before,
+ *                 with, or after the entry
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_entry (const void* key, const void* elt)
+{
+    return strcmp (key, ((const pack_entry_t*)elt)->name);
+}
+
+
+/*
+ * pack_find
+ *   DESCRIPTION: Find an asset in the pack, mapping the pack on first use.
+ *                Safe to call from any thread.
+ *   INPUTS: name -- asset name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the asset's index entry, or NULL if there is no valid
+ *                 pack or the asset is not in it
+ *   SIDE EFFECTS: may map the pack
+ */
+const pack_entry_t*
+pack_find (const char* name)
+{
+    (void)pthread_once (&pack_once, open_pack);
+    if (NULL == pack_map) {
+        return NULL;
+    }
+    return bsearch (name, pack_index, pack_hdr->n_entries,
+		    sizeof (pack_index[0]), compare_entry);
+}
+
+
+/*
+ * leave_unopened
+ *   DESCRIPTION: Stand-in for open_pack, used by pack_ignore.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+leave_unopened ()
+{
+}
+
+
+/*
+ * pack_ignore
+ *   DESCRIPTION: Make sure that the pack is never used, even if one
+ *                exists.  Must be called before any call to pack_find.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: uses up pack_once, so the pack is never mapped
+ */
+void
+pack_ignore ()
+{
+    (void)pthread_once (&pack_once, leave_unopened);
+}
+
+
+/*
+ * pack_data
+ *   DESCRIPTION: Get a pointer to data in the pack.  Only meaningful for
+ *                offsets from an entry returned by pack_find.
+ *   INPUTS: offset -- offset from start of pack
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer into the mapped pack (read-only)
+ *   SIDE EFFECTS: none
+ */
+const uint8_t*
+pack_data (uint32_t offset)
+{
+    return pack_map + offset;
+}
+
+
+/*
+ * pack_quantizer_version
+ *   DESCRIPTION: Get the quantizer version recorded in the pack.  Only
+ *                meaningful once pack_find has returned an entry.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: QUANTIZER_VERSION of the program that built the pack
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+pack_quantizer_version ()
+{
+    return pack_hdr->quantizer_version;
+}
@@ -0,0 +1,100 @@
+/*									tab:8
+ *
+ * pack.h - asset pack format and lookup header file
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    pack.h
+ */
+#ifndef PACK_H
+#define PACK_H
+
+
+#include <stdint.h>
+
+#include "photo_headers.h"
+
+
+/*
+ * An asset pack holds every room photo and object image in one file
+ * (built by mkpack), so that the game can map the file once and point
+ * photos and images straight at its pages.  The file starts with a
+ * pack_header_t, followed by an index of n_entries pack_entry_t sorted
+ * by asset name (the name passed to read_photo, for example), then the
+ * palettes, then the pixel data, with each asset's pixels starting on a
+ * PACK_ALIGN boundary.  All offsets are from the start of the file.
+ *
+ * Object images (PACK_OBJECT) and quantized room photos (PACK_PHOTO)
+ * hold one byte per pixel exactly as kept in memory (top row first for
+ * images, in tiles for photos); a quantized photo also has its 192
+ * palette colors.  Quantized photos are used only if the pack's
+ * quantizer_version is QUANTIZER_VERSION.
+ * Photos packed without quantizing (PACK_PHOTO_RAW) keep the 5:6:5
+ * pixels of the photo file (bottom row first) and are quantized as they
+ * are loaded.  Assets missing from the pack are read from their files.
+ */
+#if !defined(ASSET_PACK)
+#define ASSET_PACK "images/assets.pack"
+#endif
+#define PACK_MAGIC    0x4B503931	/* "19PK" on a little-endian host */
+#define PACK_VERSION  1
+#define PACK_ALIGN    4096		/* alignment of pixel data        */
+#define PACK_NAME_LEN 56		/* longest asset name, plus NUL   */
+
+typedef enum {PACK_OBJECT, PACK_PHOTO, PACK_PHOTO_RAW} pack_kind_t;
+
+typedef struct pack_header_t pack_header_t;
+struct pack_header_t {
+    uint32_t magic;			/* PACK_MAGIC                    */
+    uint32_t version;			/* PACK_VERSION                  */
+    uint32_t quantizer_version;		/* QUANTIZER_VERSION of builder  */
+    uint32_t n_entries;			/* number of assets in index     */
+};
+
+typedef struct pack_entry_t pack_entry_t;
+struct pack_entry_t {
+    char           name[PACK_NAME_LEN];	/* asset name                */
+    uint32_t       kind;		/* a pack_kind_t             */
+    photo_header_t hdr;			/* defines height and width  */
+    uint32_t       palette;		/* offset of 192 RGB colors  */
+    uint32_t       pixels;		/* offset of pixel data      */
+};
+
+
+/*
+ * Find an asset in the pack, mapping the pack on first use.  Returns
+ * NULL if there is no (valid) pack or the asset is not in it.
+ */
+extern const pack_entry_t* pack_find (const char* name);
+
+/*
+ * Never use the pack, even if one exists (for mkpack, which must read
+ * each asset from its own file).  Call before any other pack function.
+ */
+extern void pack_ignore ();
+
+/* Get a pointer to the data at an offset in the (mapped) pack. */
+extern const uint8_t* pack_data (uint32_t offset);
+
+/* Get the quantizer version used to build the pack. */
+extern uint32_t pack_quantizer_version ();
+
+#endif /* PACK_H */
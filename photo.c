@@ -36,29 +36,143 @@
  */
 
 
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "modex.h"
+#include "pack.h"
 #include "photo.h"
 #include "photo_headers.h"
 #include "world.h"
 
+#if !defined(USE_SIMD_HISTOGRAM)
+#if defined(__i386__) || defined(__x86_64__)
+#define USE_SIMD_HISTOGRAM 1
+#else
+#define USE_SIMD_HISTOGRAM 0
+#endif
+#endif
+#if (1 == USE_SIMD_HISTOGRAM)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Quantized room photos (palette and pixel indices) are saved in
+ * PHOTO_CACHE_DIR the first time that they are read, and later runs map
+ * the saved copy rather than choosing colors again.  A cached photo is
+ * found from the name of its source file and is used only if the size
+ * and modification time of the source file and the quantizer version all
+ * match.  Change QUANTIZER_VERSION (in photo.h) whenever color selection
+ * or the pixel layout changes.  Set USE_PHOTO_CACHE to 0 to always
+ * quantize.
+ */
+#if !defined(USE_PHOTO_CACHE)
+#define USE_PHOTO_CACHE 1
+#endif
+#if !defined(PHOTO_CACHE_DIR)
+#define PHOTO_CACHE_DIR "images/cache"
+#endif
+#define PHOTO_CACHE_MAGIC 0x51503931	/* "19PQ" on a little-endian host */
+
+/*
+ * The histogram pass reduces each pixel to a 16-bit key: the level four
+ * bucket in the top 12 bits, and the bits that the bucket drops from the
+ * 5:6:5 channels (the low bit of red, low two bits of green, and low bit
+ * of blue) in the bottom four.  With USE_SIMD_HISTOGRAM set to 1 (the
+ * default on x86), keys are made for 16 (AVX2) or 8 (SSE2) pixels at a
+ * time, as supported by the processor; otherwise one at a time.
+ *
+ * Keys are counted in HIST_LANES private histograms (pixel i going to
+ * lane i % HIST_LANES), so that runs of pixels in one bucket do not wait
+ * on each other's updates, and the lanes are summed at the end.  Each
+ * private entry packs four 16-bit counters--pixels, and the sums of the
+ * three sets of dropped bits--from which the exact channel sums can be
+ * rebuilt.  At most HIST_CHUNK pixels are counted before the lanes are
+ * summed, so that no counter overflows (the green sum grows by up to
+ * three per pixel).
+ */
+#define HIST_LANES     4
+#define HIST_CHUNK     (HIST_LANES * (65535 / 3) / 256 * 256)
+#define HIST_KEY_BLOCK 256	/* keys made at a time (multiple of 16) */
+
+/*
+ * Compressed photos (see photo_headers.h) are decoded twice, a few rows
+ * at a time, once to build the histogram and once to map the pixels into
+ * the chosen colors, so that the whole 5:6:5 image is never held in
+ * memory.  Each pass decodes at most Z_CHUNK_PIXELS at a time.
+ */
+#define Z_CHUNK_PIXELS 16384
+
+/*
+ * Photos of at least PARALLEL_PHOTO_PIXELS pixels are quantized by one
+ * thread per online processor (at most MAX_PHOTO_THREADS), each taking a
+ * band of rows.  The bands' histograms are built in parallel and summed,
+ * the colors are chosen once, and the bands are then remapped in
+ * parallel.  The sums are exact, so the photo is the same as one read
+ * by a single thread.
+ */
+#define PARALLEL_PHOTO_PIXELS (512 * 512)
+#define MAX_PHOTO_THREADS     8
+
+/*
+ * fill_rect_buffer draws the objects overlapping its rectangle from a
+ * list of at most FILL_RECT_OBJECTS; with more, it goes through all of
+ * the room's contents.
+ */
+#define FILL_RECT_OBJECTS 32
+
 
 /* types local to this file (declared in types.h) */
 
+/* Where the pixel data of a room photo lie. */
+typedef enum {PHOTO_IN_HEAP, PHOTO_IN_CACHE, PHOTO_IN_PACK} photo_storage_t;
+
 /*
  * A room photo.  Note that you must write the code that selects the
  * optimized palette colors and fills in the pixel data using them as
  * well as the code that sets up the VGA to make use of these colors.
- * Pixel data are stored as one-byte values starting from the upper
- * left and traversing the top row before returning to the left of
- * the second row, and so forth.  No padding should be used.
+ * Pixel data are stored as one-byte values in square tiles, as described
+ * with PHOTO_TILE_DIM in photo.h.
  */
 struct photo_t {
     photo_header_t hdr;			/* defines height and width */
-    uint8_t        palette[192][3];     /* optimized palette colors */
+    uint8_t        dac[256][3];         /* VGA palette: fixed colors, */
+    					/*   then optimized colors    */
     uint8_t*       img;                 /* pixel data               */
+    int32_t        storage;		/* where img lies (photo_storage_t) */
+};
+
+/* One band of rows of a photo being quantized in parallel. */
+typedef struct photo_band_t photo_band_t;
+struct photo_band_t {
+    const uint16_t* pixels;	/* file pixels (bottom row first)      */
+    photo_t*        p;		/* photo being read                    */
+    uint16_t        first;	/* first file row in band              */
+    uint16_t        end;	/* file row after band                 */
+    quantizer_t*    q;		/* band histogram, then chosen colors  */
+};
+
+/*
+ * Header of a photo cache file.  The photo's pixel data (one palette
+ * index per pixel, in tiles) follow immediately.
+ */
+typedef struct photo_cache_header_t photo_cache_header_t;
+struct photo_cache_header_t {
+    uint32_t       magic;		/* PHOTO_CACHE_MAGIC          */
+    uint32_t       version;		/* QUANTIZER_VERSION          */
+    uint64_t       src_size;		/* size of source file        */
+    int64_t        src_mtime_sec;	/* modification time of source */
+    int64_t        src_mtime_nsec;
+    photo_header_t hdr;			/* defines height and width   */
+    uint8_t        palette[192][3];     /* optimized palette colors   */
 };
 
 struct octree_t {
@@ -68,6 +182,27 @@ struct octree_t {
   unsigned int rgb[3];
 };
 
+/*
+ * Everything needed to choose the colors for one photo: the level two and
+ * level four octrees (the histogram, with the level four nodes sorted by
+ * count once colors are chosen), the 192 colors chosen, and the table that
+ * maps each level four bucket to its palette color.  read_photo keeps one
+ * on its stack, so any number of photos can be quantized at once.
+ */
+struct quantizer_t {
+  struct octree_t levelTwo[LAYER_2];
+  struct octree_t levelFour[LAYER_4];
+  uint8_t         palette[192][3];
+  uint8_t         remap[LAYER_4];
+};
+
+/* A run of opaque pixels in one row or column of an object image. */
+typedef struct image_span_t image_span_t;
+struct image_span_t {
+    uint8_t start;			/* first pixel in row/column */
+    uint8_t len;			/* number of pixels          */
+};
+
 /*
  * An object image.  The code for managing these images has been given
  * to you.  The data are simply loaded from a file, where they have
@@ -76,48 +211,143 @@ struct octree_t {
  * pixel data are stored as one-byte values starting from the upper
  * left and traversing the top row before returning to the left of the
  * second row, and so forth.  No padding is used.
+ *
+ * When an image is read, the runs of opaque pixels in each row and each
+ * column are found, so that drawing can copy each run whole and skip
+ * transparent pixels without looking at them.  The spans of row r are
+ * spans[row_spans[r]] up to (but not including) spans[row_spans[r + 1]],
+ * and likewise for columns.  A copy of the pixels stored by column (the
+ * left column first, each from the top) lets columns be copied whole.
  */
 struct image_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t*       img;                 /* pixel data               */
+    uint8_t*       cols;		/* pixel data by column     */
+    uint16_t*      row_spans;		/* first span of each row   */
+    uint16_t*      col_spans;		/* first span of each column */
+    image_span_t*  spans;		/* opaque runs              */
 };
 
 
+/*
+ * Level four (RRRRGGGGBBBB) bucket of a 5:6:5 pixel; equivalent to
+ * getIndex (pixel, 4) without the branches.
+ */
+#define LEVEL_4_INDEX(pixel)                                            \
+    ((((pixel) >> 4) & 0xF00) | (((pixel) >> 3) & 0x0F0) |              \
+     (((pixel) >> 1) & 0x00F))
+
+
+/* local functions--see function headers for details */
+static void make_keys_scalar (const uint16_t* pixels, uint16_t* keys,
+			      uint32_t n);
+#if (1 == USE_SIMD_HISTOGRAM)
+static void make_keys_sse2 (const uint16_t* pixels, uint16_t* keys,
+			    uint32_t n) __attribute__ ((target ("sse2")));
+static void make_keys_avx2 (const uint16_t* pixels, uint16_t* keys,
+			    uint32_t n) __attribute__ ((target ("avx2")));
+#endif /* USE_SIMD_HISTOGRAM */
+static void copy_photo_row (const photo_t* view, int x, int y, int n,
+			    unsigned char* buf);
+static void copy_photo_col (const photo_t* view, int x, int y, int n,
+			    unsigned char* buf, int stride);
+static void draw_object_rect (const object_t* obj, int x, int y, int w, 
+			      int h, unsigned char* buf);
+#if (1 == USE_PHOTO_CACHE)
+static void photo_cache_name (const char* fname, char* buf, size_t size);
+static int32_t read_cached_photo (photo_t* p, const char* fname,
+				  const struct stat* src);
+static void write_cached_photo (const char* fname, const struct stat* src,
+				const photo_t* p);
+#endif /* USE_PHOTO_CACHE */
+static const pack_entry_t* find_packed (const char* fname, int32_t is_photo);
+static uint32_t find_spans (const uint8_t* pixels, uint32_t len,
+			    uint32_t stride, image_span_t* spans);
+static int32_t compile_obj_image (image_t* img);
+static int32_t read_image_header (const char* fname, int32_t is_photo,
+				  photo_header_t* hdr);
+static void remap_row (const quantizer_t* q, photo_t* p,
+		       const uint16_t* row, uint16_t y);
+static void remap_rows (const quantizer_t* q, photo_t* p, 
+			const uint16_t* pixels, uint16_t first, uint16_t end);
+static void* histogram_band (void* arg);
+static void* remap_band (void* arg);
+static void run_bands (void* (*fn) (void*), photo_band_t* band, int32_t n);
+static int32_t quantize_in_bands (quantizer_t* q, photo_t* p, 
+				  const uint16_t* pixels);
+static int32_t quantize_photo (photo_t* p, const uint16_t* pixels);
+static int32_t decode_photo_row (const uint8_t** codes, const uint8_t* end,
+				 uint16_t* row, uint16_t width);
+static int32_t quantize_compressed_photo (photo_t* p, const uint8_t* codes,
+					  const uint8_t* end);
+
+
 /* file-scope variables */
-//level 2 and level four octree
-struct octree_t levelTwo[LAYER_2];
-struct octree_t levelFour[LAYER_4];
-//write byte to specified port
-#define OUTB(port,val)                                                  \
-do {                                                                    \
-    asm volatile ("                                                     \
-        outb %b1,(%w0)                                                  \
-    " : /* no outputs */                                                \
-      : "d" ((port)), "a" ((val))                                       \
-      : "memory", "cc");                                                \
-} while (0)
-//write values to two consecutive ports
-#define REP_OUTSB(port,source,count)                                    \
-do {                                                                    \
-    asm volatile ("                                                     \
-     1: movb 0(%1),%%al                                                ;\
-	outb %%al,(%w2)                                                ;\
-	incl %1                                                        ;\
-	decl %0                                                        ;\
-	jne 1b                                                          \
-    " : /* no outputs */                                                \
-      : "c" ((count)), "S" ((source)), "d" ((port))                     \
-      : "eax", "memory", "cc");                                         \
-} while (0)
+
+/*
+ * Private histogram increments for the low four bits of a key: one pixel,
+ * plus the dropped red bit, green bits, and blue bit in the upper three
+ * 16-bit counters.
+ */
+static const uint64_t dropped_bits[16] = {
+    0x0000000000000001ULL, 0x0001000000000001ULL,
+    0x0000000100000001ULL, 0x0001000100000001ULL,
+    0x0000000200000001ULL, 0x0001000200000001ULL,
+    0x0000000300000001ULL, 0x0001000300000001ULL,
+    0x0000000000010001ULL, 0x0001000000010001ULL,
+    0x0000000100010001ULL, 0x0001000100010001ULL,
+    0x0000000200010001ULL, 0x0001000200010001ULL,
+    0x0000000300010001ULL, 0x0001000300010001ULL
+};
 
 /*
  * The room currently shown on the screen.  This value is not known to
  * the mode X code, but is needed when filling buffers in callbacks from
- * that code (fill_horiz_buffer/fill_vert_buffer).  The value is set
- * by calling prep_room.
+ * that code (fill_horiz_buffer/fill_vert_buffer/fill_rect_buffer).  The
+ * value is set by calling prep_room.
  */
 static const room_t* cur_room = NULL;
 
+/*
+ * 6-bit RGB (red, green, blue) values for the first 64 colors of every
+ * room's palette, coded for 2 bits red, 2 bits green, 2 bits blue (the
+ * remaining 192 are filled in from the room photo).
+ */
+static const uint8_t fixed_RGB[64][3] = {
+    {0x00, 0x00, 0x00}, {0x00, 0x00, 0x15},
+    {0x00, 0x00, 0x2A}, {0x00, 0x00, 0x3F},
+    {0x00, 0x15, 0x00}, {0x00, 0x15, 0x15},
+    {0x00, 0x15, 0x2A}, {0x00, 0x15, 0x3F},
+    {0x00, 0x2A, 0x00}, {0x00, 0x2A, 0x15},
+    {0x00, 0x2A, 0x2A}, {0x00, 0x2A, 0x3F},
+    {0x00, 0x3F, 0x00}, {0x00, 0x3F, 0x15},
+    {0x00, 0x3F, 0x2A}, {0x00, 0x3F, 0x3F},
+    {0x15, 0x00, 0x00}, {0x15, 0x00, 0x15},
+    {0x15, 0x00, 0x2A}, {0x15, 0x00, 0x3F},
+    {0x15, 0x15, 0x00}, {0x15, 0x15, 0x15},
+    {0x15, 0x15, 0x2A}, {0x15, 0x15, 0x3F},
+    {0x15, 0x2A, 0x00}, {0x15, 0x2A, 0x15},
+    {0x15, 0x2A, 0x2A}, {0x15, 0x2A, 0x3F},
+    {0x15, 0x3F, 0x00}, {0x15, 0x3F, 0x15},
+    {0x15, 0x3F, 0x2A}, {0x15, 0x3F, 0x3F},
+    {0x2A, 0x00, 0x00}, {0x2A, 0x00, 0x15},
+    {0x2A, 0x00, 0x2A}, {0x2A, 0x00, 0x3F},
+    {0x2A, 0x15, 0x00}, {0x2A, 0x15, 0x15},
+    {0x2A, 0x15, 0x2A}, {0x2A, 0x15, 0x3F},
+    {0x2A, 0x2A, 0x00}, {0x2A, 0x2A, 0x15},
+    {0x2A, 0x2A, 0x2A}, {0x2A, 0x2A, 0x3F},
+    {0x2A, 0x3F, 0x00}, {0x2A, 0x3F, 0x15},
+    {0x2A, 0x3F, 0x2A}, {0x2A, 0x3F, 0x3F},
+    {0x3F, 0x00, 0x00}, {0x3F, 0x00, 0x15},
+    {0x3F, 0x00, 0x2A}, {0x3F, 0x00, 0x3F},
+    {0x3F, 0x15, 0x00}, {0x3F, 0x15, 0x15},
+    {0x3F, 0x15, 0x2A}, {0x3F, 0x15, 0x3F},
+    {0x3F, 0x2A, 0x00}, {0x3F, 0x2A, 0x15},
+    {0x3F, 0x2A, 0x2A}, {0x3F, 0x2A, 0x3F},
+    {0x3F, 0x3F, 0x00}, {0x3F, 0x3F, 0x15},
+    {0x3F, 0x3F, 0x2A}, {0x3F, 0x3F, 0x3F}
+};
+
 
 /*
  * fill_horiz_buffer
@@ -137,61 +367,308 @@ static const room_t* cur_room = NULL;
 void
 fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgx;  /* loop index over pixels in object image      */
-    int            yoff;  /* y offset into object image                  */
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
+    const obj_link_t* link; /* loop index over objects that may cross  */
 
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
+    /* Copy the photo (or blanks) for the line. */
+    copy_photo_row (room_photo (cur_room), x, y, SCROLL_X_DIM, buf);
 
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_X_DIM; idx++) {
-        buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
-		    view->img[view->hdr.width * y + x + idx] : 0);
+    /* Draw the objects in the current room that may cross the line. */
+    for (link = room_row_iterate (cur_room, y); NULL != link;
+    	 link = link_next (link)) {
+	draw_object_rect (link_object (link), x, y, SCROLL_X_DIM, 1, buf);
     }
+}
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
 
-        /* Is object outside of the line we're drawing? */
-	if (y < obj_y || y >= obj_y + img->hdr.height ||
-	    x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
-	    continue;
+/*
+ * copy_photo_row
+ *   DESCRIPTION: Copy part of a row of a room photo into a buffer, one
+ *                tile at a time.  Pixels outside of the photo (and all
+ *                pixels of a photo that could not be read) are blank.
+ *   INPUTS: view -- the room photo
+ *           (x,y) -- leftmost pixel of the part of the row
+ *           n -- number of pixels to copy
+ *   OUTPUTS: buf -- buffer holding n pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_photo_row (const photo_t* view, int x, int y, int n, unsigned char* buf)
+{
+    int idx;   /* loop index over pixels in the row */
+    int first; /* first pixel within the photo      */
+    int end;   /* pixel after last within the photo */
+    int len;   /* pixels of row in tile             */
+
+    (void)memset (buf, 0, n);
+    if (NULL == view->img || 0 > y || view->hdr.height <= y) {
+        return;
+    }
+    first = (0 > x ? -x : 0);
+    end = (n < view->hdr.width - x ? n : view->hdr.width - x);
+    for (idx = first; end > idx; idx += len) {
+	len = PHOTO_TILE_DIM - ((x + idx) & (PHOTO_TILE_DIM - 1));
+	if (end - idx < len) {
+	    len = end - idx;
 	}
+	(void)memcpy (&buf[idx], 
+		      &view->img[PHOTO_TILED_OFFSET (view->hdr.width, 
+						     x + idx, y)], len);
+    }
+}
 
-	/* The y offset of drawing is fixed. */
-	yoff = (y - obj_y) * img->hdr.width;
 
-	/*
-	 * The x offsets depend on whether the object starts to the left
-	 * or to the right of the starting point for the line being drawn.
-	 */
-	if (x <= obj_x) {
-	    idx = obj_x - x;
-	    imgx = 0;
-	} else {
-	    idx = 0;
-	    imgx = x - obj_x;
+/*
+ * copy_photo_col
+ *   DESCRIPTION: Copy part of a column of a room photo into a buffer, one
+ *                tile at a time (a column of a tile is PHOTO_TILE_DIM
+ *                bytes apart).  Pixels outside of the photo (and all
+ *                pixels of a photo that could not be read) are blank.
+ *   INPUTS: view -- the room photo
+ *           (x,y) -- top pixel of the part of the column
+ *           n -- number of pixels to copy
+ *           stride -- distance between pixels in buf
+ *   OUTPUTS: buf -- buffer holding n pixels, stride bytes apart
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+copy_photo_col (const photo_t* view, int x, int y, int n, unsigned char* buf,
+		int stride)
+{
+    int            idx;   /* loop index over pixels in the column */
+    int            first; /* first pixel within the photo         */
+    int            end;   /* pixel after last within the photo    */
+    int            len;   /* pixels of column in tile             */
+    int            i;     /* loop index over pixels in tile       */
+    const uint8_t* tile;  /* column of photo within one tile      */
+
+    if (NULL == view->img || 0 > x || view->hdr.width <= x) {
+	first = end = n;
+    } else {
+	first = (0 > y ? -y : 0);
+	end = (n < view->hdr.height - y ? n : view->hdr.height - y);
+
+	/* Keep both within the buffer (the part may miss the photo). */
+	if (n < first) {
+	    first = n;
+	}
+	if (first > end) {
+	    end = first;
+	}
+    }
+    for (idx = 0; first > idx; idx++) {
+        buf[idx * stride] = 0;
+    }
+    for (idx = first; end > idx; idx += len) {
+	len = PHOTO_TILE_DIM - ((y + idx) & (PHOTO_TILE_DIM - 1));
+	if (end - idx < len) {
+	    len = end - idx;
+	}
+	tile = &view->img[PHOTO_TILED_OFFSET (view->hdr.width, x, y + idx)];
+	for (i = 0; len > i; i++) {
+	    buf[(idx + i) * stride] = tile[i << PHOTO_TILE_SHIFT];
 	}
+    }
+    for (idx = end; n > idx; idx++) {
+        buf[idx * stride] = 0;
+    }
+}
+
+
+/*
+ * draw_object_rect
+ *   DESCRIPTION: Draw the part of an object's image that lies within a
+ *                rectangle of the room photo into a buffer holding the
+ *                rectangle.  Transparent pixels are left alone.
+ *   INPUTS: obj -- the object
+ *           (x,y) -- upper left pixel of the rectangle
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: buf -- buffer holding the rectangle, top row first (w
+ *                   pixels per row)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reads the object's image if it is not in memory
+ */
+static void
+draw_object_rect (const object_t* obj, int x, int y, int w, int h, 
+		  unsigned char* buf)
+{
+    const image_t* img;   /* object image                           */
+    int32_t        obj_x; /* object x position                      */
+    int32_t        obj_y; /* object y position                      */
+    int            row;   /* loop index over rows of object image   */
+    int            end_row; /* row after last within the rectangle  */
+    int            col;   /* loop index over columns of image       */
+    int            end_col; /* column after last within rectangle   */
+    const uint8_t* pixels; /* pixels of one row (or column) of image */
+    unsigned char* out;   /* the same row (or column) of rectangle  */
+    uint32_t       span;  /* loop index over opaque runs            */
+    int            first; /* first pixel of run in the rectangle    */
+    int            end;   /* pixel after run in the rectangle       */
+    int            i;     /* loop index over pixels of run          */
+
+    obj_x = obj_get_x (obj);
+    obj_y = obj_get_y (obj);
+    img = obj_image (obj);
+
+    /* Is object outside of the rectangle (or unreadable)? */
+    if (y + h <= obj_y || y >= obj_y + img->hdr.height ||
+	x + w <= obj_x || x >= obj_x + img->hdr.width ||
+	NULL == img->img) {
+	return;
+    }
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-	    pixel = img->img[yoff + imgx];
+    /* 
+     * For a rectangle taller than it is wide, loop over the columns of
+     * the image that lie within it, copying each run of opaque pixels
+     * in the column, clipped to the rectangle.
+     */
+    if (w < h) {
+	col = (x > obj_x ? x - obj_x : 0);
+	end_col = (x + w < obj_x + img->hdr.width ? 
+		   x + w - obj_x : img->hdr.width);
+	for (; end_col > col; col++) {
+	    pixels = &img->cols[col * img->hdr.height];
+	    out = &buf[obj_x + col - x];
+	    for (span = img->col_spans[col]; img->col_spans[col + 1] > span;
+		 span++) {
+		first = obj_y + img->spans[span].start - y;
+		end = first + img->spans[span].len;
+		if (0 > first) {
+		    first = 0;
+		}
+		if (h < end) {
+		    end = h;
+		}
+		if (1 == w) {
+		    if (first < end) {
+			(void)memcpy (&out[first], &pixels[y + first - obj_y],
+				      end - first);
+		    }
+		} else {
+		    for (i = first; end > i; i++) {
+			out[i * w] = pixels[y + i - obj_y];
+		    }
+		}
+	    }
+	}
+	return;
+    }
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
+    /* Otherwise loop over the rows of the image within the rectangle. */
+    row = (y > obj_y ? y - obj_y : 0);
+    end_row = (y + h < obj_y + img->hdr.height ? 
+	       y + h - obj_y : img->hdr.height);
+    for (; end_row > row; row++) {
+	pixels = &img->img[row * img->hdr.width];
+	out = &buf[(obj_y + row - y) * w];
+
+	/* 
+	 * Copy each run of opaque pixels in the row, clipped to the 
+	 * rectangle.  Transparent pixels lie between the runs.
+	 */
+	for (span = img->row_spans[row]; img->row_spans[row + 1] > span;
+	     span++) {
+	    first = obj_x + img->spans[span].start - x;
+	    end = first + img->spans[span].len;
+	    if (0 > first) {
+		first = 0;
+	    }
+	    if (w < end) {
+		end = w;
 	    }
+	    if (first < end) {
+		(void)memcpy (&out[first], &pixels[x + first - obj_x],
+			      end - first);
+	    }
+	}
+    }
+}
+
+
+/*
+ * fill_rect_buffer
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the upper left
+ *                pixel of a rectangle to be drawn on the screen, this
+ *                routine produces an image of the rectangle of the
+ *                current room (see fill_room_rect).
+ *   INPUTS: (x,y) -- upper left pixel of rectangle to be drawn
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: buf -- buffer holding image data for the rectangle (w * h
+ *                   pixels)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_rect_buffer (int x, int y, int w, int h, unsigned char* buf)
+{
+    fill_room_rect (cur_room, x, y, w, h, buf);
+}
+
+
+/*
+ * fill_room_rect
+ *   DESCRIPTION: Given the (x,y) map pixel coordinate of the upper left
+ *                pixel of a rectangle of a room, this routine produces an
+ *                image of the rectangle.  Each pixel is represented as a
+ *                single byte in the image, and the image is stored one
+ *                row after another, top row first.  The room need not be
+ *                the current room, so images of other rooms can be drawn
+ *                ahead of time.
+ *
+ *                Note that this routine draws both the room photo and
+ *                the objects in the room.
+ *
+ *   INPUTS: r -- the room
+ *           (x,y) -- upper left pixel of rectangle to be drawn
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: buf -- buffer holding image data for the rectangle (w * h
+ *                   pixels)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reads the room's photo if it is not in memory
+ */
+void
+fill_room_rect (const room_t* r, int x, int y, int w, int h, 
+		unsigned char* buf)
+{
+    const photo_t* view;  /* room photo                                  */
+    int            row;   /* loop index over rows of the rectangle       */
+    int            col;   /* loop index over columns of the rectangle    */
+    object_t*      found[FILL_RECT_OBJECTS]; /* objects in rectangle     */
+    int32_t        n_found; /* number of objects in rectangle            */
+    int32_t        idx;   /* loop index over objects found               */
+    object_t*      obj;   /* loop index over objects in the room         */
+
+    /* 
+     * Copy the photo (or blanks), one row at a time, or one column at a
+     * time for a rectangle taller than it is wide.
+     */
+    view = room_photo (r);
+    if (w < h) {
+	for (col = 0; w > col; col++) {
+	    copy_photo_col (view, x + col, y, h, &buf[col], w);
+	}
+    } else {
+	for (row = 0; h > row; row++) {
+	    copy_photo_row (view, x, y + row, w, &buf[row * w]);
+	}
+    }
+
+    /* 
+     * Draw the objects that overlap the rectangle.  If there are too many
+     * to list, draw the whole room's contents instead; those outside of
+     * the rectangle are skipped.
+     */
+    n_found = room_objects_in_rect (r, x, y, w, h, found,
+				    FILL_RECT_OBJECTS);
+    if (FILL_RECT_OBJECTS >= n_found) {
+	for (idx = 0; n_found > idx; idx++) {
+	    draw_object_rect (found[idx], x, y, w, h, buf);
+	}
+    } else {
+	for (obj = room_contents_iterate (r); NULL != obj;
+	     obj = obj_next (obj)) {
+	    draw_object_rect (obj, x, y, w, h, buf);
 	}
     }
 }
@@ -215,62 +692,15 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 void
 fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgy;  /* loop index over pixels in object image      */
-    int            xoff;  /* x offset into object image                  */
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
-
-    /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
-    }
-
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
-
-        /* Is object outside of the line we're drawing? */
-	if (x < obj_x || x >= obj_x + img->hdr.width ||
-	    y + SCROLL_Y_DIM <= obj_y || y >= obj_y + img->hdr.height) {
-	    continue;
-	}
-
-	/* The x offset of drawing is fixed. */
-	xoff = x - obj_x;
-
-	/*
-	 * The y offsets depend on whether the object starts below or
-	 * above the starting point for the line being drawn.
-	 */
-	if (y <= obj_y) {
-	    idx = obj_y - y;
-	    imgy = 0;
-	} else {
-	    idx = 0;
-	    imgy = y - obj_y;
-	}
+    const obj_link_t* link; /* loop index over objects that may cross  */
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
-	    pixel = img->img[xoff + img->hdr.width * imgy];
+    /* Copy the photo (or blanks) for the line. */
+    copy_photo_col (room_photo (cur_room), x, y, SCROLL_Y_DIM, buf, 1);
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
-	    }
-	}
+    /* Draw the objects in the current room that may cross the line. */
+    for (link = room_col_iterate (cur_room, x); NULL != link;
+    	 link = link_next (link)) {
+	draw_object_rect (link_object (link), x, y, 1, SCROLL_Y_DIM, buf);
     }
 }
 
@@ -334,156 +764,651 @@ photo_width (const photo_t* p)
 }
 
 
+/*
+ * photo_colors
+ *   DESCRIPTION: Get the palette colors chosen for a room photo.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: the 192 colors (6-bit RGB), one after another
+ *   SIDE EFFECTS: none
+ */
+const uint8_t*
+photo_colors (const photo_t* p)
+{
+    return &p->dac[64][0];
+}
+
+
+/*
+ * photo_data
+ *   DESCRIPTION: Get the pixel data of a room photo.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: one palette index per pixel, in tiles (NULL if the
+ *                 pixel data have not been read)
+ *   SIDE EFFECTS: none
+ */
+const uint8_t*
+photo_data (const photo_t* p)
+{
+    return p->img;
+}
+
+
+/*
+ * image_data
+ *   DESCRIPTION: Get the pixel data of an object image.
+ *   INPUTS: im -- object image pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: one 2:2:2 RGB value per pixel, top row first (NULL if
+ *                 the pixel data have not been read)
+ *   SIDE EFFECTS: none
+ */
+const uint8_t*
+image_data (const image_t* im)
+{
+    return im->img;
+}
+
+
+/*
+ * photo_from_cache
+ *   DESCRIPTION: Check whether a room photo was loaded already quantized,
+ *                from the photo cache or the asset pack (rather than
+ *                quantized from its source file).
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the photo came from the cache or pack, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t
+photo_from_cache (const photo_t* p)
+{
+    return (PHOTO_IN_HEAP != p->storage);
+}
+
+
 /*
  * prep_room
- *   DESCRIPTION: Prepare a new room for display.  You might want to set
- *                up the VGA palette registers according to the color
- *                palette that you chose for this room.
+ *   DESCRIPTION: Prepare a new room for display, loading the VGA palette
+ *                registers with the colors of the room's photo.
  *   INPUTS: r -- pointer to the new room
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes recorded cur_room for this file
+ *   SIDE EFFECTS: changes recorded cur_room for this file; changes
+ *                 palette colors
  */
 void
 prep_room (const room_t* r)
 {
     /* Record the current room. */
     cur_room = r;
-    photo_t * cur_photo = room_photo(cur_room);
-    /* 6-bit RGB (red, green, blue) values for first 64 colors */
-    /* these are coded for 2 bits red, 2 bits green, 2 bits blue */
-  static unsigned char palette_RGB[64][3] = {
-    {0x00, 0x00, 0x00}, {0x00, 0x00, 0x15},
-    {0x00, 0x00, 0x2A}, {0x00, 0x00, 0x3F},
-    {0x00, 0x15, 0x00}, {0x00, 0x15, 0x15},
-    {0x00, 0x15, 0x2A}, {0x00, 0x15, 0x3F},
-    {0x00, 0x2A, 0x00}, {0x00, 0x2A, 0x15},
-    {0x00, 0x2A, 0x2A}, {0x00, 0x2A, 0x3F},
-    {0x00, 0x3F, 0x00}, {0x00, 0x3F, 0x15},
-    {0x00, 0x3F, 0x2A}, {0x00, 0x3F, 0x3F},
-    {0x15, 0x00, 0x00}, {0x15, 0x00, 0x15},
-    {0x15, 0x00, 0x2A}, {0x15, 0x00, 0x3F},
-    {0x15, 0x15, 0x00}, {0x15, 0x15, 0x15},
-    {0x15, 0x15, 0x2A}, {0x15, 0x15, 0x3F},
-    {0x15, 0x2A, 0x00}, {0x15, 0x2A, 0x15},
-    {0x15, 0x2A, 0x2A}, {0x15, 0x2A, 0x3F},
-    {0x15, 0x3F, 0x00}, {0x15, 0x3F, 0x15},
-    {0x15, 0x3F, 0x2A}, {0x15, 0x3F, 0x3F},
-    {0x2A, 0x00, 0x00}, {0x2A, 0x00, 0x15},
-    {0x2A, 0x00, 0x2A}, {0x2A, 0x00, 0x3F},
-    {0x2A, 0x15, 0x00}, {0x2A, 0x15, 0x15},
-    {0x2A, 0x15, 0x2A}, {0x2A, 0x15, 0x3F},
-    {0x2A, 0x2A, 0x00}, {0x2A, 0x2A, 0x15},
-    {0x2A, 0x2A, 0x2A}, {0x2A, 0x2A, 0x3F},
-    {0x2A, 0x3F, 0x00}, {0x2A, 0x3F, 0x15},
-    {0x2A, 0x3F, 0x2A}, {0x2A, 0x3F, 0x3F},
-    {0x3F, 0x00, 0x00}, {0x3F, 0x00, 0x15},
-    {0x3F, 0x00, 0x2A}, {0x3F, 0x00, 0x3F},
-    {0x3F, 0x15, 0x00}, {0x3F, 0x15, 0x15},
-    {0x3F, 0x15, 0x2A}, {0x3F, 0x15, 0x3F},
-    {0x3F, 0x2A, 0x00}, {0x3F, 0x2A, 0x15},
-    {0x3F, 0x2A, 0x2A}, {0x3F, 0x2A, 0x3F},
-    {0x3F, 0x3F, 0x00}, {0x3F, 0x3F, 0x15},
-    {0x3F, 0x3F, 0x2A}, {0x3F, 0x3F, 0x3F}};
-    int i,j;
-    for(i = 0; i < 192; i++) {
-      for(j = 0; j < 3; j++) {
-        palette_RGB[i+64][j] = cur_photo->palette[i][j];
-      }
-    }
-    /* Start writing at color 0. */
-    OUTB (0x03C8, 0x00);
 
-    /* Write all 256 colors from array. */
-    REP_OUTSB (0x03C9, palette_RGB, 256 * 3);
+    /* Load the photo's palette, writing only the colors that change. */
+    update_palette (room_photo (cur_room)->dac);
 }
 
 
 /*
- * read_obj_image
- *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
- *                photo file and create an image structure from it.
+ * map_image_file
+ *   DESCRIPTION: Map a photo or object image file into memory (read-only)
+ *                and check that it holds at least the header and the pixel
+ *                data that the header describes.  For a compressed photo,
+ *                only the header is checked.
  *   INPUTS: fname -- file name for input
- *   OUTPUTS: none
- *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
- *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the image
+ *           pixel_size -- bytes per pixel in the file
+ *   OUTPUTS: *len -- length of the mapping in bytes
+ *   RETURN VALUE: pointer to the start of the file (the header) on success,
+ *                 or NULL on failure
+ *   SIDE EFFECTS: creates a memory mapping; caller must munmap it
  */
-image_t*
-read_obj_image (const char* fname)
+static const uint8_t*
+map_image_file (const char* fname, size_t pixel_size, size_t* len)
 {
-    FILE*    in;		/* input file               */
-    image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
+    int                   fd;   /* input file descriptor    */
+    struct stat           st;   /* file status (for size)   */
+    void*                 map;  /* mapped file contents     */
+    const photo_header_t* hdr;  /* header at start of file  */
 
-
-    /*
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (img = malloc (sizeof (*img))) ||
-	NULL != (img->img = NULL) || /* false clause for initialization */
-	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
-	MAX_OBJECT_WIDTH < img->hdr.width ||
-	MAX_OBJECT_HEIGHT < img->hdr.height ||
-	NULL == (img->img = malloc
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
-	if (NULL != img) {
-	    if (NULL != img->img) {
-	        free (img->img);
-	    }
-	    free (img);
-	}
-	if (NULL != in) {
-	    (void)fclose (in);
-	}
+    if (-1 == (fd = open (fname, O_RDONLY))) {
 	return NULL;
     }
-
-    /*
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
-
-	    /*
-	     * Try to read one 8-bit pixel.  On failure, clean up and
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
-	    }
-
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
-	}
+    if (0 != fstat (fd, &st) || sizeof (*hdr) > (size_t)st.st_size ||
+	MAP_FAILED == (map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0))) {
+	(void)close (fd);
+	return NULL;
+    }
+    (void)close (fd);
+
+    /* Make sure that all of the pixel data are present. */
+    hdr = map;
+    if (sizeof (photo_z_header_t) <= (size_t)st.st_size &&
+	PHOTO_Z_MAGIC == ((const photo_z_header_t*)map)->magic) {
+	/* The decoder checks the codes. */
+    } else if (sizeof (*hdr) + pixel_size * hdr->width * hdr->height >
+	       (size_t)st.st_size) {
+	(void)munmap (map, st.st_size);
+	return NULL;
+    }
+
+    /* We read the file front to back, once per pass. */
+    (void)madvise (map, st.st_size, MADV_SEQUENTIAL);
+    *len = st.st_size;
+    return map;
+}
+
+
+#if (1 == USE_PHOTO_CACHE)
+/*
+ * photo_cache_name
+ *   DESCRIPTION: Get the name of the photo cache file for a photo source
+ *                file, which is formed from a hash (64-bit FNV-1a) of the
+ *                source file name.
+ *   INPUTS: fname -- source file name
+ *           size -- size of buffer for cache file name
+ *   OUTPUTS: buf -- name of cache file
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+photo_cache_name (const char* fname, char* buf, size_t size)
+{
+    uint64_t    hash = 0xCBF29CE484222325ULL; /* FNV offset basis */
+    const char* c;				  /* index over name  */
+
+    for (c = fname; '\0' != *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001B3ULL;
+    }
+    (void)snprintf (buf, size, "%s/%016" PRIx64 ".qphoto", PHOTO_CACHE_DIR,
+		    hash);
+}
+
+
+/*
+ * read_cached_photo
+ *   DESCRIPTION: Look for a room photo in the photo cache and, if a
+ *                current copy is found, fill in a photo structure from it,
+ *                pointing the pixel data into a mapping of the cache file.
+ *   INPUTS: fname -- source file name
+ *           src -- status of source file
+ *   OUTPUTS: p -- the photo
+ *   RETURN VALUE: 0 on success, or -1 if the photo is not in the cache
+ *                 (or is out of date)
+ *   SIDE EFFECTS: maps the cache file for the life of the photo
+ */
+static int32_t
+read_cached_photo (photo_t* p, const char* fname, const struct stat* src)
+{
+    char                        name[256]; /* cache file name         */
+    int                         fd;	   /* cache file descriptor   */
+    struct stat                 st;	   /* cache file status       */
+    void*                       map;	   /* mapped cache file       */
+    const photo_cache_header_t* hdr;	   /* header of cache file    */
+
+    photo_cache_name (fname, name, sizeof (name));
+    if (-1 == (fd = open (name, O_RDONLY))) {
+	return -1;
+    }
+    if (0 != fstat (fd, &st) || sizeof (*hdr) > (size_t)st.st_size ||
+	MAP_FAILED == (map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				   fd, 0))) {
+	(void)close (fd);
+	return -1;
+    }
+    (void)close (fd);
+
+    /* Make sure that the copy is current and complete. */
+    hdr = map;
+    if (PHOTO_CACHE_MAGIC != hdr->magic ||
+	QUANTIZER_VERSION != hdr->version ||
+	(uint64_t)src->st_size != hdr->src_size ||
+	src->st_mtim.tv_sec != hdr->src_mtime_sec ||
+	src->st_mtim.tv_nsec != hdr->src_mtime_nsec ||
+	MAX_PHOTO_WIDTH < hdr->hdr.width ||
+	MAX_PHOTO_HEIGHT < hdr->hdr.height ||
+	sizeof (*hdr) + PHOTO_TILED_SIZE (hdr->hdr.width, hdr->hdr.height) != 
+	    (size_t)st.st_size) {
+	(void)munmap (map, st.st_size);
+	return -1;
+    }
+    p->hdr = hdr->hdr;
+    (void)memcpy (p->dac[64], hdr->palette, sizeof (hdr->palette));
+    p->img = (uint8_t*)map + sizeof (*hdr);
+    p->storage = PHOTO_IN_CACHE;
+    return 0;
+}
+
+
+/*
+ * write_cached_photo
+ *   DESCRIPTION: Save a quantized room photo in the photo cache.  The
+ *                file is written under a temporary name and then renamed,
+ *                so other readers never see a partial file.  Failures are
+ *                ignored; the photo is simply quantized again next time.
+ *   INPUTS: fname -- source file name
+ *           src -- status of source file
+ *           p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates PHOTO_CACHE_DIR if necessary; writes a file
+ */
+static void
+write_cached_photo (const char* fname, const struct stat* src,
+		    const photo_t* p)
+{
+    char                 name[256]; /* cache file name           */
+    char                 tmp[256];  /* temporary file name       */
+    int                  fd;	    /* temporary file descriptor */
+    photo_cache_header_t hdr;	    /* header of cache file      */
+    size_t               len;	    /* bytes of pixel data       */
+
+    (void)memset (&hdr, 0, sizeof (hdr));
+    hdr.magic = PHOTO_CACHE_MAGIC;
+    hdr.version = QUANTIZER_VERSION;
+    hdr.src_size = src->st_size;
+    hdr.src_mtime_sec = src->st_mtim.tv_sec;
+    hdr.src_mtime_nsec = src->st_mtim.tv_nsec;
+    hdr.hdr = p->hdr;
+    (void)memcpy (hdr.palette, p->dac[64], sizeof (hdr.palette));
+    len = PHOTO_TILED_SIZE (p->hdr.width, p->hdr.height);
+
+    (void)mkdir (PHOTO_CACHE_DIR, 0777);
+    photo_cache_name (fname, name, sizeof (name));
+    (void)snprintf (tmp, sizeof (tmp), "%s/tmp.XXXXXX", PHOTO_CACHE_DIR);
+    if (-1 == (fd = mkstemp (tmp))) {
+        return;
+    }
+    if (sizeof (hdr) != write (fd, &hdr, sizeof (hdr)) ||
+	len != write (fd, p->img, len) ||
+	0 != fchmod (fd, 0644)) {
+	(void)close (fd);
+	(void)unlink (tmp);
+	return;
+    }
+
+    /* The descriptor is released even if close fails; close it once. */
+    if (0 != close (fd)) {
+	(void)unlink (tmp);
+	return;
+    }
+    if (0 != rename (tmp, name)) {
+	(void)unlink (tmp);
+    }
+}
+#endif /* USE_PHOTO_CACHE */
+
+
+/*
+ * find_packed
+ *   DESCRIPTION: Look for an object image or room photo in the asset
+ *                pack.  Quantized photos are ignored unless they were
+ *                made with the current quantizer.
+ *   INPUTS: fname -- file name of asset
+ *           is_photo -- 1 for a room photo, 0 for an object image
+ *   OUTPUTS: none
+ *   RETURN VALUE: the asset's pack entry, or NULL if it must be read from
+ *                 its own file
+ *   SIDE EFFECTS: maps the pack on first use
+ */
+static const pack_entry_t*
+find_packed (const char* fname, int32_t is_photo)
+{
+    const pack_entry_t* e;	/* entry in pack */
+
+    if (NULL == (e = pack_find (fname))) {
+        return NULL;
+    }
+    if (!is_photo) {
+	return (PACK_OBJECT == e->kind ? e : NULL);
+    }
+    if (PACK_PHOTO_RAW == e->kind ||
+	(PACK_PHOTO == e->kind &&
+	 QUANTIZER_VERSION == pack_quantizer_version ())) {
+	return e;
+    }
+    return NULL;
+}
+
+
+/*
+ * read_image_header
+ *   DESCRIPTION: Read just the header of a photo or object image, from
+ *                the asset pack if it is there, or else from its file.
+ *   INPUTS: fname -- file name for input
+ *           is_photo -- 1 for a room photo, 0 for an object image
+ *   OUTPUTS: hdr -- the header
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+read_image_header (const char* fname, int32_t is_photo, photo_header_t* hdr)
+{
+    int                 fd;	/* input file descriptor */
+    const pack_entry_t* e;	/* entry in asset pack   */
+    photo_z_header_t    z_hdr;	/* compressed header     */
+    ssize_t             len;	/* bytes of header read  */
+
+    if (NULL != (e = find_packed (fname, is_photo))) {
+        *hdr = e->hdr;
+	return 0;
+    }
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+	return -1;
+    }
+    len = read (fd, &z_hdr, sizeof (z_hdr));
+    (void)close (fd);
+
+    /* Uncompressed files start with just the photo header. */
+    if (sizeof (z_hdr) == len && PHOTO_Z_MAGIC == z_hdr.magic) {
+	*hdr = z_hdr.hdr;
+    } else if (sizeof (*hdr) <= len) {
+	(void)memcpy (hdr, &z_hdr, sizeof (*hdr));
+    } else {
+	return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * read_obj_image_header
+ *   DESCRIPTION: Create an image structure holding only the size of an
+ *                object image; the pixel data can be read later with
+ *                read_obj_image_pixels.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated image on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+image_t*
+read_obj_image_header (const char* fname)
+{
+    image_t* img;	/* image structure */
+
+    if (NULL == (img = malloc (sizeof (*img)))) {
+        return NULL;
+    }
+    if (0 != read_image_header (fname, 0, &img->hdr) ||
+	MAX_OBJECT_WIDTH < img->hdr.width ||
+	MAX_OBJECT_HEIGHT < img->hdr.height) {
+	free (img);
+	return NULL;
+    }
+    img->img = NULL;
+    img->cols = NULL;
+    return img;
+}
+
+
+/*
+ * find_spans
+ *   DESCRIPTION: Find the runs of opaque pixels in one row or column of
+ *                an object image.
+ *   INPUTS: pixels -- first pixel of the row or column
+ *           len -- number of pixels in the row or column
+ *           stride -- distance between successive pixels
+ *   OUTPUTS: spans -- the runs (unless NULL, to just count them)
+ *   RETURN VALUE: number of runs
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+find_spans (const uint8_t* pixels, uint32_t len, uint32_t stride,
+	    image_span_t* spans)
+{
+    uint32_t n = 0;	/* number of runs found          */
+    uint32_t i;		/* index over pixels             */
+    uint32_t start;	/* first pixel of current run    */
+
+    for (i = 0; len > i; ) {
+	/* Skip transparent pixels, then find the end of the run. */
+	if (OBJ_CLR_TRANSP == pixels[i * stride]) {
+	    i++;
+	    continue;
+	}
+	for (start = i; len > i && OBJ_CLR_TRANSP != pixels[i * stride]; i++) {
+	}
+	if (NULL != spans) {
+	    spans[n].start = start;
+	    spans[n].len = i - start;
+	}
+	n++;
+    }
+    return n;
+}
+
+
+/*
+ * compile_obj_image
+ *   DESCRIPTION: Find the runs of opaque pixels in every row and column of
+ *                an object image and make the copy of its pixels by
+ *                column (see image_t).
+ *   INPUTS: img -- the image (with pixel data)
+ *   OUTPUTS: img -- the image's runs and column copy
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out
+ *   SIDE EFFECTS: dynamically allocates memory for the runs and copy
+ */
+static int32_t
+compile_obj_image (image_t* img)
+{
+    uint32_t w = img->hdr.width;  /* image width            */
+    uint32_t h = img->hdr.height; /* image height           */
+    uint32_t n = 0;		  /* number of runs         */
+    uint32_t i;			  /* index over rows/columns */
+    uint32_t y;			  /* index over column pixels */
+    uint8_t* block;		  /* storage for everything */
+
+    /* Count the runs, then make room for the tables and the copy. */
+    for (i = 0; h > i; i++) {
+	n += find_spans (&img->img[w * i], w, 1, NULL);
+    }
+    for (i = 0; w > i; i++) {
+	n += find_spans (&img->img[i], h, w, NULL);
+    }
+    if (NULL == (block = malloc ((h + 1 + w + 1) * sizeof (uint16_t) +
+				 n * sizeof (image_span_t) + w * h))) {
+	return -1;
+    }
+    img->row_spans = (uint16_t*)block;
+    img->col_spans = img->row_spans + h + 1;
+    img->spans = (image_span_t*)(img->col_spans + w + 1);
+    img->cols = (uint8_t*)(img->spans + n);
+
+    /* Record the runs of each row, then of each column. */
+    img->row_spans[0] = 0;
+    for (i = 0; h > i; i++) {
+	img->row_spans[i + 1] = img->row_spans[i] + 
+	    find_spans (&img->img[w * i], w, 1, &img->spans[img->row_spans[i]]);
+    }
+    img->col_spans[0] = img->row_spans[h];
+    for (i = 0; w > i; i++) {
+	img->col_spans[i + 1] = img->col_spans[i] + 
+	    find_spans (&img->img[i], h, w, &img->spans[img->col_spans[i]]);
+	for (y = 0; h > y; y++) {
+	    img->cols[h * i + y] = img->img[w * y + i];
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * read_obj_image_pixels
+ *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
+ *                photo file into an image structure.  An image in the
+ *                asset pack is not copied; its pixel data point into the
+ *                (read-only) pack.
+ *   INPUTS: img -- the image
+ *           fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure (in which case the image
+ *                 is left without pixel data)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixel data
+ */
+int32_t
+read_obj_image_pixels (image_t* img, const char* fname)
+{
+    const uint8_t*      file;	/* mapped file contents     */
+    size_t              len;	/* length of mapping        */
+    const uint8_t*      pixels;	/* pixel data in the file   */
+    uint16_t            y;	/* index over image rows    */
+    const pack_entry_t* e;	/* entry in asset pack      */
+
+    /* Use the packed copy if there is one. */
+    img->img = NULL;
+    img->cols = NULL;
+    if (NULL != (e = find_packed (fname, 0))) {
+	img->hdr = e->hdr;
+	if (MAX_OBJECT_WIDTH < img->hdr.width ||
+	    MAX_OBJECT_HEIGHT < img->hdr.height) {
+	    return -1;
+	}
+	img->img = (uint8_t*)pack_data (e->pixels);
+	if (0 != compile_obj_image (img)) {
+	    img->img = NULL;
+	    return -1;
+	}
+	return 0;
+    }
+
+    /*
+     * Map the file, copy the header, do some sanity checks on it, and
+     * allocate space to hold the image pixels.  If anything fails, clean
+     * up as necessary and return failure.
+     */
+    if (NULL == (file = map_image_file (fname, sizeof (img->img[0]), &len)) ||
+	NULL == memcpy (&img->hdr, file, sizeof (img->hdr)) ||
+	MAX_OBJECT_WIDTH < img->hdr.width ||
+	MAX_OBJECT_HEIGHT < img->hdr.height ||
+	NULL == (img->img = malloc
+		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
+	if (NULL != file) {
+	    (void)munmap ((void*)file, len);
+	}
+	return -1;
+    }
+
+    /*
+     * Copy rows from bottom to top.  Note that the file is stored in
+     * this order, whereas in memory we store the data in the reverse
+     * order (top to bottom).
+     */
+    pixels = file + sizeof (img->hdr);
+    for (y = 0; img->hdr.height > y; y++) {
+	memcpy (&img->img[img->hdr.width * (img->hdr.height - 1 - y)],
+		&pixels[img->hdr.width * y], img->hdr.width);
+    }
+
+    (void)munmap ((void*)file, len);
+
+    /* Find the opaque runs. */
+    if (0 != compile_obj_image (img)) {
+	free (img->img);
+	img->img = NULL;
+	return -1;
     }
 
     /* All done.  Return success. */
-    (void)fclose (in);
+    return 0;
+}
+
+
+/*
+ * read_obj_image
+ *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
+ *                photo file and create an image structure from it.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+image_t*
+read_obj_image (const char* fname)
+{
+    image_t* img;	/* image structure */
+
+    if (NULL == (img = malloc (sizeof (*img)))) {
+        return NULL;
+    }
+    if (0 != read_obj_image_pixels (img, fname)) {
+	free (img);
+	return NULL;
+    }
     return img;
 }
 
 
+/*
+ * read_photo_header
+ *   DESCRIPTION: Create a photo structure holding only the size of a room
+ *                photo; the palette and pixel data can be read later with
+ *                read_photo_pixels.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+read_photo_header (const char* fname)
+{
+    photo_t* p;	/* photo structure */
+
+    if (NULL == (p = malloc (sizeof (*p)))) {
+        return NULL;
+    }
+    if (0 != read_image_header (fname, 1, &p->hdr) ||
+	MAX_PHOTO_WIDTH < p->hdr.width ||
+	MAX_PHOTO_HEIGHT < p->hdr.height) {
+	free (p);
+	return NULL;
+    }
+    (void)memset (p->dac, 0, sizeof (p->dac));
+    p->img = NULL;
+    p->storage = PHOTO_IN_HEAP;
+    return p;
+}
+
+
+/*
+ * free_photo_pixels
+ *   DESCRIPTION: Release the palette and pixel data of a photo, leaving
+ *                only its size; read_photo_pixels can fill them in again.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory or unmaps the photo's cache file (pixels
+ *                 in the asset pack are left mapped)
+ */
+void
+free_photo_pixels (photo_t* p)
+{
+    if (NULL == p->img) {
+        return;
+    }
+    switch (p->storage) {
+	case PHOTO_IN_HEAP:
+	    free (p->img);
+	    break;
+	case PHOTO_IN_CACHE:
+	    (void)munmap (p->img - sizeof (photo_cache_header_t), 
+			  sizeof (photo_cache_header_t) + 
+			  PHOTO_TILED_SIZE (p->hdr.width, p->hdr.height));
+	    break;
+	case PHOTO_IN_PACK:
+	    break;		/* the pack stays mapped */
+    }
+    p->img = NULL;
+    p->storage = PHOTO_IN_HEAP;
+}
+
+
 /*
  * read_photo
  *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
  *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
  *   INPUTS: fname -- file name for input
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
@@ -493,188 +1418,706 @@ read_obj_image (const char* fname)
 photo_t*
 read_photo (const char* fname)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
-    uint16_t rgb_cur[3];
-    int p_index;
-    uint16_t index_l4, index_l2;
-    int i; // loop counter
-    /*
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
-     */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (p = malloc (sizeof (*p))) ||
-	NULL != (p->img = NULL) || /* false clause for initialization */
-	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-	MAX_PHOTO_WIDTH < p->hdr.width ||
-	MAX_PHOTO_HEIGHT < p->hdr.height ||
-	NULL == (p->img = malloc
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
-	if (NULL != p) {
-	    if (NULL != p->img) {
-	        free (p->img);
-	    }
-	    free (p);
+    photo_t* p;	/* photo structure */
+
+    if (NULL == (p = malloc (sizeof (*p)))) {
+        return NULL;
+    }
+    if (0 != read_photo_pixels (p, fname)) {
+	free (p);
+	return NULL;
+    }
+    return p;
+}
+
+
+/*
+ * remap_row
+ *   DESCRIPTION: Map one row of photo file pixels into palette colors
+ *                chosen for the photo.  Note that the file is stored
+ *                from bottom to top, whereas in memory we store the data
+ *                in the reverse order (top to bottom).
+ *   INPUTS: q -- quantizer holding the chosen colors
+ *           row -- file pixels of the row
+ *           y -- file row number
+ *   OUTPUTS: p -- the photo (one row of pixel data)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+remap_row (const quantizer_t* q, photo_t* p, const uint16_t* row, uint16_t y)
+{
+    uint8_t* out;	/* part of photo row in one tile */
+    uint16_t x;		/* index over image columns      */
+    uint16_t i;		/* index over columns in tile    */
+    uint16_t n;		/* columns in tile               */
+
+    /* Loop over tiles from left to right; one table load per pixel. */
+    for (x = 0; p->hdr.width > x; x += PHOTO_TILE_DIM) {
+	out = &p->img[PHOTO_TILED_OFFSET (p->hdr.width, x, 
+					  p->hdr.height - 1 - y)];
+	n = (PHOTO_TILE_DIM < p->hdr.width - x ? 
+	     PHOTO_TILE_DIM : p->hdr.width - x);
+	for (i = 0; n > i; i++) {
+	    out[i] = q->remap[LEVEL_4_INDEX (row[x + i])];
 	}
-	if (NULL != in) {
-	    (void)fclose (in);
+    }
+}
+
+
+/*
+ * remap_rows
+ *   DESCRIPTION: Map a range of rows of photo file pixels into palette
+ *                colors chosen for the photo.
+ *   INPUTS: q -- quantizer holding the chosen colors
+ *           pixels -- file pixels
+ *           first -- first file row to map
+ *           end -- file row after the last to map
+ *   OUTPUTS: p -- the photo (rows of pixel data)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+remap_rows (const quantizer_t* q, photo_t* p, const uint16_t* pixels,
+	    uint16_t first, uint16_t end)
+{
+    uint16_t y;		/* index over image rows */
+
+    /* Map each row of the file into the matching photo row. */
+    for (y = first; end > y; y++) {
+	remap_row (q, p, &pixels[p->hdr.width * y], y);
+    }
+}
+
+
+/*
+ * histogram_band
+ *   DESCRIPTION: Thread body that builds the histogram of one band.
+ *   INPUTS: arg -- the band (photo_band_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in the band's quantizer
+ */
+static void*
+histogram_band (void* arg)
+{
+    photo_band_t* b = arg;	/* the band */
+
+    initialize_octrees (b->q);
+    add_to_octrees (b->q, &b->pixels[b->p->hdr.width * b->first],
+		    b->p->hdr.width * (b->end - b->first));
+    return NULL;
+}
+
+
+/*
+ * remap_band
+ *   DESCRIPTION: Thread body that maps one band into the chosen colors.
+ *   INPUTS: arg -- the band (photo_band_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in the band's rows of the photo
+ */
+static void*
+remap_band (void* arg)
+{
+    photo_band_t* b = arg;	/* the band */
+
+    remap_rows (b->q, b->p, b->pixels, b->first, b->end);
+    return NULL;
+}
+
+
+/*
+ * run_bands
+ *   DESCRIPTION: Run a function on every band, one thread per band, and
+ *                wait for all of them.  The first band (and any band for
+ *                which no thread can be made) runs in the calling thread.
+ *   INPUTS: fn -- the function
+ *           band -- the bands
+ *           n -- number of bands
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates and joins threads
+ */
+static void
+run_bands (void* (*fn) (void*), photo_band_t* band, int32_t n)
+{
+    pthread_t id[MAX_PHOTO_THREADS];	 /* band threads        */
+    int32_t   started[MAX_PHOTO_THREADS]; /* was thread created? */
+    int32_t   idx;			 /* index over bands    */
+
+    for (idx = 1; n > idx; idx++) {
+	started[idx] = (0 == pthread_create (&id[idx], NULL, fn, &band[idx]));
+    }
+    (void)(*fn) (&band[0]);
+    for (idx = 1; n > idx; idx++) {
+	if (started[idx]) {
+	    (void)pthread_join (id[idx], NULL);
+	} else {
+	    (void)(*fn) (&band[idx]);
 	}
-	return NULL;
     }
+}
+
+
+/*
+ * quantize_in_bands
+ *   DESCRIPTION: Choose colors for a large photo and map its pixels into
+ *                them using several threads (see PARALLEL_PHOTO_PIXELS).
+ *   INPUTS: pixels -- file pixels
+ *   OUTPUTS: q -- quantizer holding the chosen colors
+ *            p -- the photo (pixel data)
+ *   RETURN VALUE: 0 on success, or -1 if the photo is too small to be
+ *                 worth splitting (or memory runs out), in which case the
+ *                 caller must do the work
+ *   SIDE EFFECTS: creates and joins threads
+ */
+static int32_t
+quantize_in_bands (quantizer_t* q, photo_t* p, const uint16_t* pixels)
+{
+    photo_band_t band[MAX_PHOTO_THREADS]; /* the bands               */
+    quantizer_t* hist;			  /* histograms of bands 1..n */
+    int32_t      n;			  /* number of bands          */
+    int32_t      idx;			  /* index over bands         */
+    int32_t      i;			  /* index over buckets       */
+
+    /* Pick the number of bands. */
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (MAX_PHOTO_THREADS < n) {
+        n = MAX_PHOTO_THREADS;
+    }
+    if (PARALLEL_PHOTO_PIXELS > p->hdr.width * p->hdr.height || 2 > n ||
+	NULL == (hist = malloc ((n - 1) * sizeof (*hist)))) {
+	return -1;
+    }
+
+    /* Build the band histograms, using q itself for the first band. */
+    for (idx = 0; n > idx; idx++) {
+	band[idx].pixels = pixels;
+	band[idx].p = p;
+	band[idx].first = p->hdr.height * idx / n;
+	band[idx].end = p->hdr.height * (idx + 1) / n;
+	band[idx].q = (0 == idx ? q : &hist[idx - 1]);
+    }
+    run_bands (histogram_band, band, n);
+
+    /* Sum the histograms and choose the colors. */
+    for (idx = 1; n > idx; idx++) {
+	for (i = 0; LAYER_4 > i; i++) {
+	    q->levelFour[i].color_count += hist[idx - 1].levelFour[i].color_count;
+	    q->levelFour[i].rgb[0] += hist[idx - 1].levelFour[i].rgb[0];
+	    q->levelFour[i].rgb[1] += hist[idx - 1].levelFour[i].rgb[1];
+	    q->levelFour[i].rgb[2] += hist[idx - 1].levelFour[i].rgb[2];
+	}
+    }
+    free (hist);
+    select_colors (q);
+
+    /* Map the bands into the colors. */
+    for (idx = 0; n > idx; idx++) {
+	band[idx].q = q;
+    }
+    run_bands (remap_band, band, n);
+    return 0;
+}
+
+
+/*
+ * quantize_photo
+ *   DESCRIPTION: Choose the palette colors for a photo from a histogram
+ *                of its pixels, then map the pixels into them (in parallel
+ *                bands, for large photos).
+ *   INPUTS: p -- the photo (with its header filled in)
+ *           pixels -- 5:6:5 pixels in file order (bottom row first)
+ *   OUTPUTS: p -- the photo (palette and pixel data)
+ *   RETURN VALUE: 0 on success, or -1 if memory runs out (in which case
+ *                 the photo is left without pixel data)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixel data
+ */
+static int32_t
+quantize_photo (photo_t* p, const uint16_t* pixels)
+{
+    quantizer_t q;	/* color selection state */
+
+    if (NULL == (p->img = calloc 
+		 (PHOTO_TILED_SIZE (p->hdr.width, p->hdr.height), 1))) {
+	return -1;
+    }
+    p->storage = PHOTO_IN_HEAP;
+    if (0 != quantize_in_bands (&q, p, pixels)) {
+	initialize_octrees (&q);
+	add_to_octrees (&q, pixels, p->hdr.width * p->hdr.height);
+	select_colors (&q);
+	remap_rows (&q, p, pixels, 0, p->hdr.height);
+    }
+    (void)memcpy (p->dac[64], q.palette, sizeof (q.palette));
+    return 0;
+}
+
+
+/*
+ * decode_photo_row
+ *   DESCRIPTION: Decode one row of a compressed photo (see
+ *                photo_headers.h).
+ *   INPUTS: *codes -- codes for the row
+ *           end -- end of the codes in the file
+ *           width -- pixels in the row
+ *   OUTPUTS: *codes -- codes for the next row
+ *            row -- the row's 5:6:5 pixels
+ *   RETURN VALUE: 0 on success, or -1 if the codes are bad
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+decode_photo_row (const uint8_t** codes, const uint8_t* end, uint16_t* row,
+		  uint16_t width)
+{
+    const uint8_t* c = *codes;	/* next code byte            */
+    uint32_t       prev = 0;	/* previous pixel in row     */
+    uint32_t       x = 0;	/* index over row            */
+    uint32_t       n;		/* length of run             */
+    uint8_t        b;		/* first byte of code        */
 
-  initialize_octrees();
     /*
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
+     * The encoder only codes changes that keep every channel in range, so
+     * a change can be added to the whole 5:6:5 pixel at once.
      */
-    for (y = p->hdr.height; y-- > 0; ) {
-
-	     /* Loop over columns from left to right. */
-	      for (x = 0; p->hdr.width > x; x++) {
-
-	    /*
-	     * Try to read one 16-bit pixel.  On failure, clean up and
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		      free (p->img);
-		      free (p);
-	        (void)fclose (in);
-		      return NULL;
+    while (width > x) {
+	if (end <= c) {
+	    return -1;
+	}
+	b = *c++;
+	if (0 == (b & 0x80)) {
+	    prev += ((b >> 5) - PHOTO_Z_SMALL_R) * 0x800 +
+		    (((b >> 2) & 0x7) - PHOTO_Z_SMALL_G) * 0x20 +
+		    (b & 0x3) - PHOTO_Z_SMALL_B;
+	} else if (PHOTO_Z_RUN > b) {
+	    if (end <= c) {
+		return -1;
 	    }
-	    /*
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette
-	     * to match the colors needed for that photo.
-	     */
-       //isolate red by getting rid of GB values (6+5), mask with 11111 (5 bits)
-       //and shift, making it a 6 bit value
-       rgb_cur[0] = ((((pixel >> 11) & 0x1F)) << 1);
-       //isolate green by getting rid og B value (5 bits), mask with 111111 (6 bits)
-       //No need to shift because it is already six bits
-       rgb_cur[1] = ((pixel >> 5) & 0x3F);
-       //no need to isolate blue since it's already at the end, mask with 11111 (5 bits)
-       //and shift, making it a 6 bit value
-       rgb_cur[2] = ((pixel & 0x1F) << 1);
-       //get index of octree color
-       index_l4 = getIndex(pixel, 4);
-       index_l2 = getIndex(pixel, 2);
-      for(i = 0; i < 3; i++) {
-        //add values of rgb_cur to octree rgb values
-        levelTwo[index_l2].rgb[i] += rgb_cur[i];
-        levelFour[index_l4].rgb[i] += rgb_cur[i];
-      }
-      //increment counts for both octrees
-      levelTwo[index_l2].color_count++;
-      levelFour[index_l4].color_count++;
+	    prev += (((b >> 2) & 0xF) - PHOTO_Z_LARGE_R) * 0x800 +
+		    ((((b & 0x3) << 4) | (*c >> 4)) - PHOTO_Z_LARGE_G) * 0x20 +
+		    (*c & 0xF) - PHOTO_Z_LARGE_B;
+	    c++;
+	} else if (PHOTO_Z_WHOLE > b) {
+	    n = (b & 0x3F) + 1;
+	    if (n > width - x) {
+		return -1;
+	    }
+	    while (0 < n--) {
+		row[x++] = prev;
+	    }
+	    continue;
+	} else {
+	    if (2 > end - c) {
+		return -1;
+	    }
+	    prev = c[0] | (c[1] << 8);
+	    c += 2;
+	}
+	row[x++] = prev;
     }
-  }
-  //sort levelFour octree with regards to count
-  qsort(levelFour, LAYER_4, sizeof(struct octree_t), &compare);
-  //add 128 colors with highest count to palette
-  for(i = 0; i < 128; i++) {
-    //store LevelFour color values into palette
-    storeInPalette(p, 4, i);
-    //loop through levelTwo and LevelFour and subtract out any edges
-    //intersections so that there is no overlap
-    int j;
-    int l2 = (((levelFour[i].color_index >> 10) & 0x3) << 4) +
-         (((levelFour[i].color_index >> 6) & 0x3) << 2) +
-         ((levelFour[i].color_index >> 2) & 0x3);
-    for(j = 0; j < 3; j++) {
-      levelTwo[l2].rgb[j] = levelTwo[l2].rgb[j] - levelFour[i].rgb[j];
+    *codes = c;
+    return 0;
+}
+
+
+/*
+ * quantize_compressed_photo
+ *   DESCRIPTION: Choose the palette colors for a compressed photo and map
+ *                its pixels into them, decoding the photo once for each
+ *                pass (see Z_CHUNK_PIXELS).
+ *   INPUTS: p -- the photo (with its header filled in)
+ *           codes -- codes for the first (bottom) row
+ *           end -- end of the codes in the file
+ *   OUTPUTS: p -- the photo (palette and pixel data)
+ *   RETURN VALUE: 0 on success, or -1 if the codes are bad or memory runs
+ *                 out (in which case the photo is left without pixel data)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixel data
+ */
+static int32_t
+quantize_compressed_photo (photo_t* p, const uint8_t* codes,
+			   const uint8_t* end)
+{
+    quantizer_t    q;			/* color selection state    */
+    uint16_t       chunk[Z_CHUNK_PIXELS]; /* decoded rows           */
+    const uint8_t* c;			/* codes for next row       */
+    uint16_t       rows;		/* rows per chunk           */
+    uint16_t       n;			/* rows in this chunk       */
+    uint16_t       y;			/* index over image rows    */
+    uint16_t       i;			/* index over chunk rows    */
+
+    if (NULL == (p->img = calloc 
+		 (PHOTO_TILED_SIZE (p->hdr.width, p->hdr.height), 1))) {
+	return -1;
     }
-    levelTwo[l2].color_count = levelTwo[l2].color_count - levelFour[i].color_count;
-    //save index value for later. will come in handy
-    levelFour[i].pixel_index = i + 64;
-  }
-  //store L2 value in palette
-  storeInPalette(p, 2, 0);
+    p->storage = PHOTO_IN_HEAP;
+
+    /* Build the histogram a chunk of rows at a time. */
+    initialize_octrees (&q);
+    rows = (0 == p->hdr.width ? 1 : Z_CHUNK_PIXELS / p->hdr.width);
+    c = codes;
+    for (y = 0; p->hdr.height > y; y += n) {
+	n = (rows < p->hdr.height - y ? rows : p->hdr.height - y);
+	for (i = 0; n > i; i++) {
+	    if (0 != decode_photo_row (&c, end, &chunk[p->hdr.width * i],
+				       p->hdr.width)) {
+		free (p->img);
+		p->img = NULL;
+		return -1;
+	    }
+	}
+	add_to_octrees (&q, chunk, p->hdr.width * n);
+    }
+    select_colors (&q);
 
-  //set file pointer to beginning of file, offset by 4 bytes for image dimensions
-  fseek(in, 4, SEEK_SET);
+    /* 
+     * Decode again, mapping each row into the matching photo row.  The
+     * codes were checked by the first pass.
+     */
+    c = codes;
+    for (y = 0; p->hdr.height > y; y++) {
+	(void)decode_photo_row (&c, end, chunk, p->hdr.width);
+	remap_row (&q, p, chunk, y);
+    }
+    (void)memcpy (p->dac[64], q.palette, sizeof (q.palette));
+    return 0;
+}
 
-  /*
-   * Loop over rows from bottom to top.  Note that the file is stored
-   * in this order, whereas in memory we store the data in the reverse
-   * order (top to bottom).
-   */
-  for (y = p->hdr.height; y-- > 0; ) {
 
-    /* Loop over columns from left to right. */
-    for (x = 0; p->hdr.width > x; x++) {
+/*
+ * read_photo_pixels
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file into a photo structure, choosing the palette
+ *                colors for the photo and mapping the pixels into them
+ *                (or using the cached result of doing so).  A photo
+ *                quantized in the asset pack is not copied; its pixel
+ *                data point into the (read-only) pack.
+ *   INPUTS: p -- the photo
+ *           fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure (in which case the photo
+ *                 is left without pixel data)
+ *   SIDE EFFECTS: dynamically allocates memory for the pixel data
+ */
+int32_t
+read_photo_pixels (photo_t* p, const char* fname)
+{
+    const uint8_t*      file;	/* mapped file contents     */
+    size_t              len;	/* length of mapping        */
+    const pack_entry_t* e;	/* entry in asset pack      */
+    const photo_z_header_t* z_hdr; /* compressed header     */
+    int32_t             is_z;	/* 1 if file is compressed  */
+#if (1 == USE_PHOTO_CACHE)
+    struct stat         src;	/* source file status       */
+    int32_t             have_src; /* 1 if src is valid        */
+#endif /* USE_PHOTO_CACHE */
 
     /*
-     * Try to read one 16-bit pixel.  On failure, clean up and
-     * return NULL.
+     * The photo's colors follow the fixed colors in its VGA palette,
+     * which is then ready to load as it is.
      */
-    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-        free (p->img);
-        free (p);
-        (void)fclose (in);
-        return NULL;
+    (void)memcpy (p->dac, fixed_RGB, sizeof (fixed_RGB));
+
+    /* Use the packed copy if there is one, quantizing it if necessary. */
+    p->img = NULL;
+    if (NULL != (e = find_packed (fname, 1))) {
+	p->hdr = e->hdr;
+	if (MAX_PHOTO_WIDTH < p->hdr.width ||
+	    MAX_PHOTO_HEIGHT < p->hdr.height) {
+	    return -1;
+	}
+	if (PACK_PHOTO_RAW == e->kind) {
+	    return quantize_photo (p, (const uint16_t*)pack_data (e->pixels));
+	}
+	(void)memcpy (p->dac[64], pack_data (e->palette), 192 * 3);
+	p->img = (uint8_t*)pack_data (e->pixels);
+	p->storage = PHOTO_IN_PACK;
+	return 0;
     }
 
-    index_l4 = getIndex(pixel, 4);
-    p_index = -1;
-    //test to see if desired color is in level four
-    for(i = 0; i < 128; i++) {
-      if(levelFour[i].color_index == index_l4) {
-        p_index = levelFour[i].pixel_index;
-        break;
-      }
+#if (1 == USE_PHOTO_CACHE)
+    /* Use the cached copy if there is a current one. */
+    have_src = (0 == stat (fname, &src));
+    if (have_src && 0 == read_cached_photo (p, fname, &src)) {
+        return 0;
+    }
+#endif /* USE_PHOTO_CACHE */
+
+    /*
+     * Map the file, copy the header, and do some sanity checks on it, 
+     * then choose the colors and map the pixels (decoding them first,
+     * for a compressed photo).  If anything fails, clean up as necessary
+     * and return failure.
+     */
+    if (NULL == (file = map_image_file (fname, sizeof (uint16_t), &len))) {
+	return -1;
     }
-    //if not then search level two
-    if(p_index == -1) {
-      p_index = getIndex(pixel, 2);
+    z_hdr = (const photo_z_header_t*)file;
+    is_z = (sizeof (*z_hdr) <= len && PHOTO_Z_MAGIC == z_hdr->magic);
+    p->hdr = (is_z ? z_hdr->hdr : *(const photo_header_t*)file);
+    if (MAX_PHOTO_WIDTH < p->hdr.width ||
+	MAX_PHOTO_HEIGHT < p->hdr.height ||
+	0 != (is_z ? 
+	      quantize_compressed_photo (p, file + sizeof (*z_hdr), 
+					 file + len) :
+	      quantize_photo (p, (const uint16_t*)(file + sizeof (p->hdr))))) {
+	(void)munmap ((void*)file, len);
+	return -1;
     }
-    //drop palette down into image
-    p->img[p->hdr.width * y + x] = 64 + p_index;
-  }
-}
+    (void)munmap ((void*)file, len);
+
+#if (1 == USE_PHOTO_CACHE)
+    /* Save the result for next time. */
+    if (have_src) {
+        write_cached_photo (fname, &src, p);
+    }
+#endif /* USE_PHOTO_CACHE */
 
     /* All done.  Return success. */
-    (void)fclose (in);
-    return p;
+    return 0;
 }
 
 /*
 * initialize_octrees
-*   DESCRIPTION: Initialize level four and level two octrees
-*   INPUTS: none
+*   DESCRIPTION: Initialize level four and level two octrees of a quantizer
+*   INPUTS: q - quantizer to initialize
 *   OUTPUTS: none
 *   RETURN VALUE: none
-*   SIDE EFFECTS: Set all octree values to 0
+*   SIDE EFFECTS: Set all octree values and palette colors to 0
 */
-void initialize_octrees() {
+void initialize_octrees(quantizer_t* q) {
   int i,j;
   //initialize level two nodes
   for(i = 0; i < LAYER_2; i++) {
     for(j = 0; j < 3; j++) {
-      levelTwo[i].rgb[j] = 0;
+      q->levelTwo[i].rgb[j] = 0;
     }
-    levelTwo[i].color_count = 0;
-    levelTwo[i].color_index = i;
+    q->levelTwo[i].color_count = 0;
+    q->levelTwo[i].color_index = i;
   }
   //initialize level four nodes
   for(i = 0; i < LAYER_4; i++) {
     for(j = 0; j < 3; j++) {
-      levelFour[i].rgb[j] = 0;
+      q->levelFour[i].rgb[j] = 0;
+    }
+    q->levelFour[i].color_count = 0;
+    q->levelFour[i].color_index = i;
+  }
+  (void)memset (q->palette, 0, sizeof (q->palette));
+}
+
+/*
+ * make_keys_scalar
+ *   DESCRIPTION: Make histogram keys (see HIST_LANES) for 5:6:5 pixels.
+ *   INPUTS: pixels -- the pixels
+ *           n -- number of pixels
+ *   OUTPUTS: keys -- one key per pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+make_keys_scalar (const uint16_t* pixels, uint16_t* keys, uint32_t n)
+{
+    uint32_t idx;	/* index over pixels */
+    uint16_t p;		/* one pixel         */
+
+    for (idx = 0; n > idx; idx++) {
+	p = pixels[idx];
+	keys[idx] = ((p & 0xF000) | ((p << 1) & 0x0F00) | ((p << 3) & 0x00F0) |
+		     ((p >> 8) & 0x8) | ((p >> 4) & 0x6) | (p & 0x1));
+    }
+}
+
+
+#if (1 == USE_SIMD_HISTOGRAM)
+/*
+ * make_keys_sse2
+ *   DESCRIPTION: Make histogram keys for 5:6:5 pixels, eight at a time.
+ *   INPUTS: pixels -- the pixels
+ *           n -- number of pixels
+ *   OUTPUTS: keys -- one key per pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+make_keys_sse2 (const uint16_t* pixels, uint16_t* keys, uint32_t n)
+{
+    const __m128i m_r  = _mm_set1_epi16 ((short)0xF000); /* bucket red   */
+    const __m128i m_g  = _mm_set1_epi16 (0x0F00);	 /* bucket green */
+    const __m128i m_b  = _mm_set1_epi16 (0x00F0);	 /* bucket blue  */
+    const __m128i m_lr = _mm_set1_epi16 (0x0008);	 /* dropped red  */
+    const __m128i m_lg = _mm_set1_epi16 (0x0006);	 /* dropped green */
+    const __m128i m_lb = _mm_set1_epi16 (0x0001);	 /* dropped blue */
+    __m128i       p;	/* eight pixels    */
+    __m128i       k;	/* their keys      */
+    uint32_t      idx;	/* index over pixels */
+
+    for (idx = 0; n >= idx + 8; idx += 8) {
+	p = _mm_loadu_si128 ((const __m128i*)&pixels[idx]);
+	k = _mm_and_si128 (p, m_r);
+	k = _mm_or_si128 (k, _mm_and_si128 (_mm_slli_epi16 (p, 1), m_g));
+	k = _mm_or_si128 (k, _mm_and_si128 (_mm_slli_epi16 (p, 3), m_b));
+	k = _mm_or_si128 (k, _mm_and_si128 (_mm_srli_epi16 (p, 8), m_lr));
+	k = _mm_or_si128 (k, _mm_and_si128 (_mm_srli_epi16 (p, 4), m_lg));
+	k = _mm_or_si128 (k, _mm_and_si128 (p, m_lb));
+	_mm_storeu_si128 ((__m128i*)&keys[idx], k);
+    }
+    make_keys_scalar (&pixels[idx], &keys[idx], n - idx);
+}
+
+
+/*
+ * make_keys_avx2
+ *   DESCRIPTION: Make histogram keys for 5:6:5 pixels, 16 at a time.
+ *   INPUTS: pixels -- the pixels
+ *           n -- number of pixels
+ *   OUTPUTS: keys -- one key per pixel
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+make_keys_avx2 (const uint16_t* pixels, uint16_t* keys, uint32_t n)
+{
+    const __m256i m_r  = _mm256_set1_epi16 ((short)0xF000); /* bucket red   */
+    const __m256i m_g  = _mm256_set1_epi16 (0x0F00);	    /* bucket green */
+    const __m256i m_b  = _mm256_set1_epi16 (0x00F0);	    /* bucket blue  */
+    const __m256i m_lr = _mm256_set1_epi16 (0x0008);	    /* dropped red  */
+    const __m256i m_lg = _mm256_set1_epi16 (0x0006);	    /* dropped green */
+    const __m256i m_lb = _mm256_set1_epi16 (0x0001);	    /* dropped blue */
+    __m256i       p;	/* sixteen pixels    */
+    __m256i       k;	/* their keys        */
+    uint32_t      idx;	/* index over pixels */
+
+    for (idx = 0; n >= idx + 16; idx += 16) {
+	p = _mm256_loadu_si256 ((const __m256i*)&pixels[idx]);
+	k = _mm256_and_si256 (p, m_r);
+	k = _mm256_or_si256 (k, _mm256_and_si256 (_mm256_slli_epi16 (p, 1), m_g));
+	k = _mm256_or_si256 (k, _mm256_and_si256 (_mm256_slli_epi16 (p, 3), m_b));
+	k = _mm256_or_si256 (k, _mm256_and_si256 (_mm256_srli_epi16 (p, 8), m_lr));
+	k = _mm256_or_si256 (k, _mm256_and_si256 (_mm256_srli_epi16 (p, 4), m_lg));
+	k = _mm256_or_si256 (k, _mm256_and_si256 (p, m_lb));
+	_mm256_storeu_si256 ((__m256i*)&keys[idx], k);
+    }
+    make_keys_scalar (&pixels[idx], &keys[idx], n - idx);
+}
+#endif /* USE_SIMD_HISTOGRAM */
+
+
+/*
+* add_to_octrees
+*   DESCRIPTION: Add pixels to the level four histogram (the level two
+*                histogram is filled in from it by select_colors)
+*   INPUTS: q - quantizer; pixels - 5:6:5 RGB pixels; n_pixels - how many
+*   OUTPUTS: none
+*   RETURN VALUE: none
+*   SIDE EFFECTS: adds to octree counts and color sums
+*/
+void add_to_octrees(quantizer_t* q, const uint16_t* pixels, uint32_t n_pixels) {
+  uint64_t lane[HIST_LANES][LAYER_4]; //private histograms (see HIST_LANES)
+  uint16_t keys[HIST_KEY_BLOCK];
+  void (*make_keys) (const uint16_t*, uint16_t*, uint32_t);
+  uint32_t done, end, n;
+  uint32_t i, l;
+  uint64_t w;
+  unsigned int cnt;
+
+  //pick the widest key maker that the processor supports
+  make_keys = make_keys_scalar;
+#if (1 == USE_SIMD_HISTOGRAM)
+  if (__builtin_cpu_supports ("avx2")) {
+    make_keys = make_keys_avx2;
+  } else if (__builtin_cpu_supports ("sse2")) {
+    make_keys = make_keys_sse2;
+  }
+#endif /* USE_SIMD_HISTOGRAM */
+
+  /*
+   * The histogram does not depend on pixel order, so we simply walk
+   * the pixels in the order given, a chunk at a time.
+   */
+  for (done = 0; n_pixels > done; ) {
+    (void)memset (lane, 0, sizeof (lane));
+    end = (n_pixels - done > HIST_CHUNK ? done + HIST_CHUNK : n_pixels);
+    for (; end > done; done += n) {
+      n = (end - done > HIST_KEY_BLOCK ? HIST_KEY_BLOCK : end - done);
+      make_keys (&pixels[done], keys, n);
+      for (i = 0; n > i; i++) {
+        lane[i % HIST_LANES][keys[i] >> 4] += dropped_bits[keys[i] & 0xF];
+      }
+    }
+
+    //sum the lanes; each channel is 4 * bucket value plus the dropped bits
+    //(red and blue are 5-bit channels shifted up to 6 bits)
+    for (i = 0; i < LAYER_4; i++) {
+      for (l = 0; l < HIST_LANES; l++) {
+        if (0 == (w = lane[l][i])) {
+          continue;
+        }
+        cnt = w & 0xFFFF;
+        q->levelFour[i].color_count += cnt;
+        q->levelFour[i].rgb[0] += 4 * (i >> 8) * cnt + 2 * ((w >> 16) & 0xFFFF);
+        q->levelFour[i].rgb[1] += 4 * ((i >> 4) & 0xF) * cnt + ((w >> 32) & 0xFFFF);
+        q->levelFour[i].rgb[2] += 4 * (i & 0xF) * cnt + 2 * (w >> 48);
+      }
+    }
+  }
+}
+
+/*
+* select_colors
+*   DESCRIPTION: Choose the 192 palette colors from the histograms and build
+*                the level four bucket to palette color table
+*   INPUTS: q - quantizer holding the histograms of a photo
+*   OUTPUTS: none
+*   RETURN VALUE: none
+*   SIDE EFFECTS: sorts level four octree by count; fills palette and remap
+*/
+void select_colors(quantizer_t* q) {
+  int i, j;
+  int l2;
+  //each levelTwo bucket holds the levelFour buckets that share the top
+  //two bits of each component
+  for(i = 0; i < LAYER_4; i++) {
+    l2 = (((i >> 10) & 0x3) << 4) + (((i >> 6) & 0x3) << 2) + ((i >> 2) & 0x3);
+    for(j = 0; j < 3; j++) {
+      q->levelTwo[l2].rgb[j] += q->levelFour[i].rgb[j];
     }
-    levelFour[i].color_count = 0;
-    levelFour[i].color_index = i;
+    q->levelTwo[l2].color_count += q->levelFour[i].color_count;
+  }
+  //sort levelFour octree with regards to count
+  qsort(q->levelFour, LAYER_4, sizeof(struct octree_t), &compare);
+  //add 128 colors with highest count to palette
+  for(i = 0; i < 128; i++) {
+    //store LevelFour color values into palette
+    storeInPalette(q, 4, i);
+    //loop through levelTwo and LevelFour and subtract out any edges
+    //intersections so that there is no overlap
+    l2 = (((q->levelFour[i].color_index >> 10) & 0x3) << 4) +
+         (((q->levelFour[i].color_index >> 6) & 0x3) << 2) +
+         ((q->levelFour[i].color_index >> 2) & 0x3);
+    for(j = 0; j < 3; j++) {
+      q->levelTwo[l2].rgb[j] = q->levelTwo[l2].rgb[j] - q->levelFour[i].rgb[j];
+    }
+    q->levelTwo[l2].color_count = q->levelTwo[l2].color_count - q->levelFour[i].color_count;
+    //save index value for later. will come in handy
+    q->levelFour[i].pixel_index = i + 64;
+  }
+  //store L2 value in palette
+  storeInPalette(q, 2, 0);
+
+  /*
+   * Build the table that maps each level four bucket straight to its
+   * final palette color.  Buckets that did not make the top 128 use the
+   * level two color that contains them; the level two index is just the
+   * top two bits of each of the bucket's four-bit components.
+   */
+  for (i = 0; i < LAYER_4; i++) {
+    q->remap[i] = 64 + ((((i >> 10) & 0x3) << 4) + (((i >> 6) & 0x3) << 2) +
+			((i >> 2) & 0x3));
+  }
+  for (i = 0; i < 128; i++) {
+    q->remap[q->levelFour[i].color_index] = 64 + q->levelFour[i].pixel_index;
   }
 }
 
@@ -697,7 +2140,6 @@ int compare(const void * left, const void * right) {
   else
     return 0;
 }
-
 /*
 * getIndex
 *   DESCRIPTION: get the index of pixel based on RGB value
@@ -733,27 +2175,27 @@ int getIndex(uint16_t pixel, int val) {
 /*
 * storeInPalette
 *   DESCRIPTION: Store color in palette
-*   INPUTS: p - pointer to photo, val - level2 or level4, index - index at which to load color
+*   INPUTS: q - quantizer, val - level2 or level4, index - index at which to load color
 *   OUTPUTS: none
 *   RETURN VALUE:NULL
-*   SIDE EFFECTS: fills palette
+*   SIDE EFFECTS: fills quantizer palette
 */
-void storeInPalette(photo_t* p, int val, int index) {
+void storeInPalette(quantizer_t* q, int val, int index) {
   int i,j; //loop counter
   if(val == 2) {//store L2 values
     for(i = 0; i < 64; i++) {
-      if(levelTwo[i].color_count != 0) {
+      if(q->levelTwo[i].color_count != 0) {
         for(j = 0; j < 3; j++) { //fill up palette according to algorithm
-          p->palette[i][j] = levelTwo[i].rgb[j] / levelTwo[i].color_count;
+          q->palette[i][j] = q->levelTwo[i].rgb[j] / q->levelTwo[i].color_count;
         }
       }
-      levelTwo[i].pixel_index = i;
+      q->levelTwo[i].pixel_index = i;
     }
   }
   else if(val == 4) { //sore L4 values
-    if(levelFour[index].color_count != 0) {
+    if(q->levelFour[index].color_count != 0) {
       for(i = 0; i < 3; i++) {//fill up palette according to algorithm
-        p->palette[index+64][i] = levelFour[index].rgb[i] / levelFour[index].color_count;
+        q->palette[index+64][i] = q->levelFour[index].rgb[i] / q->levelFour[index].color_count;
       }
     }
   }
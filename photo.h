@@ -52,6 +52,35 @@
 #define MAX_OBJECT_WIDTH  160
 #define MAX_OBJECT_HEIGHT 100
 
+/*
+ * Version of the color selection and the layout of quantized pixels;
+ * quantized photos saved by older versions (in the photo cache or the
+ * asset pack) are not used.
+ */
+#define QUANTIZER_VERSION 2
+
+/*
+ * The pixels of a room photo are kept in square tiles of PHOTO_TILE_DIM
+ * by PHOTO_TILE_DIM pixels, so that a vertical strip of the photo, like
+ * a horizontal one, lies in a few cache lines and pages.  Each tile is
+ * stored row by row; the tiles are stored from the top left, across each
+ * row of tiles before going down to the next.  Tiles along the right and
+ * bottom edges are padded (with zeros) to full size.  PHOTO_TILED_SIZE
+ * gives the bytes of pixel data for a photo, and PHOTO_TILED_OFFSET the
+ * position of pixel (x,y) within them.
+ */
+#define PHOTO_TILE_SHIFT 5
+#define PHOTO_TILE_DIM   (1 << PHOTO_TILE_SHIFT)
+#define PHOTO_TILES(n)   (((n) + PHOTO_TILE_DIM - 1) >> PHOTO_TILE_SHIFT)
+#define PHOTO_TILED_SIZE(width,height)                                  \
+    (PHOTO_TILES (width) * PHOTO_TILES (height) *                       \
+     PHOTO_TILE_DIM * PHOTO_TILE_DIM)
+#define PHOTO_TILED_OFFSET(width,x,y)                                   \
+    (((((y) >> PHOTO_TILE_SHIFT) * PHOTO_TILES (width) +                \
+       ((x) >> PHOTO_TILE_SHIFT)) << (2 * PHOTO_TILE_SHIFT)) +          \
+     (((y) & (PHOTO_TILE_DIM - 1)) << PHOTO_TILE_SHIFT) +               \
+     ((x) & (PHOTO_TILE_DIM - 1)))
+
 //layer sizes for octrees
 #define LAYER_4 4096
 #define LAYER_2 64
@@ -63,6 +92,16 @@ extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
 /* Fill a buffer with the pixels for a vertical line of current room. */
 extern void fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
 
+/* 
+ * Fill a buffer with the pixels for a rectangle of current room (w * h
+ * pixels, top row first).
+ */
+extern void fill_rect_buffer (int x, int y, int w, int h, unsigned char* buf);
+
+/* Fill a buffer with the pixels for a rectangle of any room. */
+extern void fill_room_rect (const room_t* r, int x, int y, int w, int h,
+			    unsigned char* buf);
+
 /* Get height of object image in pixels. */
 extern uint32_t image_height (const image_t* im);
 
@@ -75,6 +114,19 @@ extern uint32_t photo_height (const photo_t* p);
 /* Get width of room photo in pixels. */
 extern uint32_t photo_width (const photo_t* p);
 
+/* Get palette colors (192 6-bit RGB triples) of room photo. */
+extern const uint8_t* photo_colors (const photo_t* p);
+
+/*
+ * Get pixel data of room photo (in tiles; see PHOTO_TILE_DIM) or object
+ * image (top row first).
+ */
+extern const uint8_t* photo_data (const photo_t* p);
+extern const uint8_t* image_data (const image_t* im);
+
+/* Check whether a room photo was loaded from the photo cache or pack. */
+extern int32_t photo_from_cache (const photo_t* p);
+
 /*
  * Prepare room for display (record pointer for use by callbacks, set up
  * VGA palette, etc.).
@@ -86,14 +138,35 @@ extern image_t* read_obj_image (const char* fname);
 
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo (const char* fname);
+
+/*
+ * Read only the size of an object image or room photo, leaving the
+ * pixel data to be filled in later (returns NULL on failure).
+ */
+extern image_t* read_obj_image_header (const char* fname);
+extern photo_t* read_photo_header (const char* fname);
+
+/*
+ * Fill in the pixel data (and palette, for photos) of an image or photo.
+ * Returns 0 on success, or -1 on failure, leaving no pixel data.
+ */
+extern int32_t read_obj_image_pixels (image_t* img, const char* fname);
+extern int32_t read_photo_pixels (photo_t* p, const char* fname);
+
+/* Release the pixel data of a photo (they can be read again later). */
+extern void free_photo_pixels (photo_t* p);
 //initialize octrees and set values to 0
-void initialize_octrees();
+void initialize_octrees(quantizer_t* q);
+//add 5:6:5 pixels to the octree histograms
+void add_to_octrees(quantizer_t* q, const uint16_t* pixels, uint32_t n_pixels);
+//choose palette colors and build the bucket to color table
+void select_colors(quantizer_t* q);
 //compare function for quicksort
 int compare(const void* left, const void* right);
 //get index for two layer or 4 layer pixel
 int getIndex(uint16_t pixel, int val);
 //stores color dependent on val (L2 or L4) into palette at index
-void storeInPalette(photo_t* p, int val, int index);
+void storeInPalette(quantizer_t* q, int val, int index);
 /*
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
  * I chose not to bother freeing image data before terminating the program.
@@ -81,5 +81,42 @@ struct photo_header_t {
     uint16_t height;	/* image height in pixels */
 };
 
+/*
+ * Compressed room photo file header.  A compressed photo holds the same
+ * 5:6:5 pixels in the same order, but each row is coded separately as a
+ * stream of one- to three-byte codes, each giving one or more pixels in
+ * terms of the previous pixel in the row (taken to be 0 at the start of
+ * each row):
+ *
+ *   0rrgggbb           small change: red and blue by -2..1, green by
+ *                      -4..3 (each stored with the bias added)
+ *   10rrrrgg ggggbbbb  larger change: red and blue by -8..7, green by
+ *                      -32..31
+ *   11nnnnnn           n + 1 more copies of the previous pixel, for n
+ *                      from 0 to PHOTO_Z_MAX_RUN - 1 (runs do not cross
+ *                      rows)
+ *   0xFF, 2 bytes      a pixel, stored whole (little-endian)
+ *
+ * The magic number reads as a width larger than any photo, so files of
+ * both kinds can share the .photo suffix.
+ */
+#define PHOTO_Z_MAGIC     0x5A503931	/* "19PZ" on a little-endian host */
+#define PHOTO_Z_SMALL_R   2		/* biases of small changes        */
+#define PHOTO_Z_SMALL_G   4
+#define PHOTO_Z_SMALL_B   2
+#define PHOTO_Z_LARGE     0x80		/* tag of larger changes          */
+#define PHOTO_Z_LARGE_R   8		/* biases of larger changes       */
+#define PHOTO_Z_LARGE_G   32
+#define PHOTO_Z_LARGE_B   8
+#define PHOTO_Z_RUN       0xC0		/* tag of runs                    */
+#define PHOTO_Z_MAX_RUN   63
+#define PHOTO_Z_WHOLE     0xFF		/* tag of whole pixels            */
+
+typedef struct photo_z_header_t photo_z_header_t;
+struct photo_z_header_t {
+    uint32_t       magic;	/* PHOTO_Z_MAGIC                  */
+    photo_header_t hdr;		/* defines height and width       */
+};
+
 #endif /* PHOTO_HEADERS_H */
 
@@ -0,0 +1,179 @@
+/*									tab:8
+ *
+ * photobench.c - room photo load time benchmark
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    photobench.c
+ */
+
+/*
+ * This file is a utility program that measures how long the game takes
+ * to read room photos, so that raw and compressed photo files (made by
+ * mp2zphoto) can be compared.  Each photo is read twice: first after
+ * asking the kernel to drop the file from the page cache (cold), then
+ * again with the file in memory (warm).  The photo cache and the asset
+ * pack are not used, so every read quantizes the photo.
+ *
+ * The bytes read are the sizes of the files, which are read in full;
+ * where the kernel reports it, the data fetched from storage during the
+ * cold reads are also shown.
+ */
+
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pack.h"
+#include "photo.h"
+
+
+// The photo code lives alongside the game's world, which reports
+// through the status bar; there is none here.
+void
+show_status (const char* s)
+{
+}
+
+// Return milliseconds elapsed since a start time.
+static double
+elapsed_msec (const struct timespec* start)
+{
+    struct timespec now;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+	   (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Return bytes that this process has fetched from storage, or -1 if the
+// kernel does not say.
+static long long
+storage_bytes_read ()
+{
+    FILE*     in;
+    char      line[80];
+    long long bytes = -1;
+
+    if (NULL == (in = fopen ("/proc/self/io", "r"))) {
+        return -1;
+    }
+    while (NULL != fgets (line, sizeof (line), in)) {
+	if (1 == sscanf (line, "read_bytes: %lld", &bytes)) {
+	    break;
+	}
+    }
+    (void)fclose (in);
+    return bytes;
+}
+
+// Drop a file from the page cache.  Return its size in bytes, or -1 if
+// it cannot be opened.
+static long long
+evict_file (const char* fname)
+{
+    int         fd;
+    struct stat st;
+
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+        return -1;
+    }
+    if (0 != fstat (fd, &st)) {
+	(void)close (fd);
+	return -1;
+    }
+    (void)posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+    (void)close (fd);
+    return st.st_size;
+}
+
+// Read one photo, timing the read.  Return the time in milliseconds, or
+// a negative value if the photo cannot be read.
+static double
+time_photo (const char* fname)
+{
+    struct timespec start;
+    photo_t*        p;
+    double          msec;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    if (NULL == (p = read_photo (fname))) {
+        fprintf (stderr, "%s is not a valid room photo.\n", fname);
+	return -1;
+    }
+    msec = elapsed_msec (&start);
+    free_photo_pixels (p);
+    free (p);
+    return msec;
+}
+
+int
+main (int argc, char* argv[])
+{
+    int       i;
+    long long size;
+    long long bytes = 0;
+    long long before;
+    long long after;
+    double    cold;
+    double    warm;
+    double    total_cold = 0;
+    double    total_warm = 0;
+
+    // Check syntax of invocation.
+    if (2 > argc) {
+    	fprintf (stderr, "usage: %s <room photo file> ...\n", argv[0]);
+	return 2;
+    }
+
+    // Read each photo cold, then warm.
+    pack_ignore ();
+    before = storage_bytes_read ();
+    for (i = 1; argc > i; i++) {
+	if (0 > (size = evict_file (argv[i]))) {
+	    perror (argv[i]);
+	    return 2;
+	}
+	if (0 > (cold = time_photo (argv[i])) ||
+	    0 > (warm = time_photo (argv[i]))) {
+	    return 2;
+	}
+	printf ("%8.2f ms cold %8.2f ms warm %9lld bytes  %s\n", cold, warm,
+		size, argv[i]);
+	bytes += size;
+	total_cold += cold;
+	total_warm += warm;
+    }
+    after = storage_bytes_read ();
+
+    printf ("%8.2f ms cold %8.2f ms warm %9lld bytes  total for %d photos\n",
+	    total_cold, total_warm, bytes, argc - 1);
+    if (0 <= before && 0 <= after) {
+	printf ("%lld bytes fetched from storage\n", after - before);
+    }
+    return 0;
+}
@@ -33,28 +33,72 @@
  *		Integrated original release back into main code base.
  */
 
+#include <stdint.h>
 #include <string.h>
 
 #include "text.h"
 
+
+/*
+ * Each row of each character in the font, expanded to a mask of its
+ * eight pixels (0xFF where the font bit is set, in the order drawn), so
+ * that textToGraphics can draw a row of a character with one masked
+ * store rather than testing each bit.  The masks are made on first use.
+ */
+static uint64_t glyph_mask[256][FONT_HEIGHT];
+static int glyph_masks_made = 0;
+
+static void make_glyph_masks();
+
+
+/*
+ * make_glyph_masks
+ *   DESCRIPTION: expands font_data into glyph_mask
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in glyph_mask
+ */
+static void make_glyph_masks() {
+	int c,j,k; //loop counters over characters, rows, and pixels
+	unsigned char pixels[FONT_WIDTH]; //mask of one row, in pixel order
+
+	for(c = 0; c < 256; c++) {
+		for(j = 0; j < FONT_HEIGHT; j++) {
+			for(k = 0; k < FONT_WIDTH; k++) {
+				pixels[k] = ((128 >> k) & font_data[c][j]) ? 0xFF : 0x00;
+			}
+			memcpy(&glyph_mask[c][j], pixels, sizeof(pixels));
+		}
+	}
+	glyph_masks_made = 1;
+}
+
 /*
  * textToGraphics
  *   DESCRIPTION: fills in buffer according to font data and what is in str, aligned to value represented by align_value. Also sets color of text
- *   INPUTS: buffer -- pointer to buffer character array
+ *   INPUTS: buffer -- pointer to buffer character array (the status bar image, STAT_BAR_ROWS rows of
+ *                     STAT_BAR_WIDTH pixels, top row first)
  *           str -- pointer to array of characters to be converted to graphics and displayed on screen
  *			 align_value -- value representing left, center, or right alignment
  *   OUTPUTS: updates buffer array with the data needed to display text onto screen
  *   RETURN VALUE: none
- *   SIDE EFFECTS: allows user to type a maximum of 20 characters on status bar, and sets color to parameter set in text.h
+ *   SIDE EFFECTS: allows user to type a maximum of 20 characters on status bar, and sets color to parameter set in text.h;
+ *                 makes the glyph masks on first call
  */
 
 void textToGraphics(unsigned char *buffer, const char * str, int align_value) {
-	int i,j,k; //for loop counters
+	int i,j; //for loop counters
 	int length = strlen(str); //length of string;
 	int location; //location of status message
-	unsigned char data; //holder variable for font_data location
-	int str_val; //holder variable for row number of font_data
-	int bitmask; //bitmask to test for font_data pixel
+	const uint64_t color = 0x0101010101010101ULL * TEXT_COLOR; //text color in all eight pixels
+	const uint64_t *mask; //glyph masks for character
+	uint64_t row; //eight pixels of buffer
+	unsigned char *pixel; //first pixel of character row in buffer
+
+	if(!glyph_masks_made) {
+		make_glyph_masks();
+	}
 
 	//check whether message is left-aligned(0), center-aligned(1), or right-aligned(full-right: 2 / one letter over: 3)
 	if(align_value == 0) {
@@ -72,22 +116,14 @@ void textToGraphics(unsigned char *buffer, const char * str, int align_value) {
 
 
 	for(i = 0; i < length; i++) { //traverse through string length
+		mask = glyph_mask[(int)str[i]]; //masks for character that user has typed
 		for(j = 0; j < FONT_HEIGHT; j++) { //traverse through font array horizontally
-			str_val = (int)str[i];
-			data = font_data[str_val][j];	//store font_data for specific pixel depending on what user has typed
-			for(k = 0; k < FONT_WIDTH; k++) {
-				bitmask = 128 >> k;		//tests if bitmask (MSB = 1) matches up with pixel in font data
-				if((bitmask & data) != 0) {
-					if(k <=3) {
-						//draw set color of first half of pixel
-						buffer[k * STAT_BAR_HEIGHT * STAT_BAR_ROWS + STAT_BAR_HEIGHT * (j+1) + 2*i + location] = TEXT_COLOR;
-					}
-					else if(k > 3) {
-						//draw and set color of second half of pixel
-						buffer[k % 4 * STAT_BAR_HEIGHT * STAT_BAR_ROWS + STAT_BAR_HEIGHT * (j+1) + 2*i + location + 1] = TEXT_COLOR;
-					}
-				}
-			}
+			//location counts groups of four pixels (one byte in each plane)
+			pixel = buffer + STAT_BAR_WIDTH * (j+1) + FONT_WIDTH*i + 4*location;
+			//set the pixels in the mask to the text color, and keep the others
+			memcpy(&row, pixel, sizeof(row));
+			row = (row & ~mask[j]) | (color & mask[j]);
+			memcpy(pixel, &row, sizeof(row));
 		}
 	}
 }
@@ -41,6 +41,7 @@
 #define FONT_HEIGHT 		16
 #define STAT_BAR_HEIGHT		80
 #define STAT_BAR_ROWS		18
+#define STAT_BAR_WIDTH		(STAT_BAR_HEIGHT * 4)	/* pixels per row */
 #define TEXT_COLOR			12
 #define BACKGROUND_COLOR	 5
 
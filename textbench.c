@@ -0,0 +1,104 @@
+/*									tab:8
+ *
+ * textbench.c - status bar text drawing benchmark
+ *
+ * "Copyright (c) 2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    textbench.c
+ */
+
+
+/*
+ * This file is a utility program that measures how quickly textToGraphics
+ * draws characters into the status bar image, as create_status_bar does
+ * whenever the status bar's strings change.  Strings of several lengths
+ * are drawn many times with each alignment, and the rate is reported in
+ * characters per second.  The first call (which prepares the font) is
+ * timed separately.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "text.h"
+
+
+#define N_CALLS 200000	// calls to textToGraphics per string and alignment
+
+
+// Return nanoseconds elapsed since a start time.
+static double
+elapsed_nsec (const struct timespec* start)
+{
+    struct timespec now;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+int
+main ()
+{
+    static const char* str[] = {
+        "_",
+	"get board",
+	"You can't do that here!",
+	"Room with a view of the Illini Union"
+    };
+    static const int align[] = {0, 1, 3};
+    unsigned char   image[STAT_BAR_ROWS * STAT_BAR_WIDTH];
+    struct timespec start;
+    int             s;
+    int             a;
+    int             i;
+    double          nsec;
+    double          total_nsec = 0;
+    long            total_chars = 0;
+
+    (void)memset (image, BACKGROUND_COLOR, sizeof (image));
+
+    // Time the first call.
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    textToGraphics (image, str[0], 0);
+    printf ("first call:  %8.1f us\n", elapsed_nsec (&start) / 1e3);
+
+    // Time each string with each alignment.
+    for (s = 0; sizeof (str) / sizeof (str[0]) > s; s++) {
+	nsec = 0;
+	for (a = 0; sizeof (align) / sizeof (align[0]) > a; a++) {
+	    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+	    for (i = 0; N_CALLS > i; i++) {
+		textToGraphics (image, str[s], align[a]);
+	    }
+	    nsec += elapsed_nsec (&start);
+	}
+	total_nsec += nsec;
+	total_chars += strlen (str[s]) * N_CALLS * 3L;
+	printf ("%2d chars:    %8.1f ns/call %7.2f Mchar/s\n",
+		(int)strlen (str[s]), nsec / (N_CALLS * 3.0),
+		strlen (str[s]) * N_CALLS * 3e3 / nsec);
+    }
+    printf ("all strings: %8.1f ns/char %7.2f Mchar/s\n",
+	    total_nsec / total_chars, total_chars * 1e3 / total_nsec);
+    return 0;
+}
@@ -37,9 +37,12 @@
 /* types defined in photo.c */
 typedef struct photo_t photo_t;
 typedef struct image_t image_t;
+typedef struct quantizer_t quantizer_t;
 
 /* types defined in world.h */
 typedef struct room_t room_t;
 typedef struct object_t object_t;
+typedef struct obj_link_t obj_link_t;
+typedef struct dirty_rect_t dirty_rect_t;
 
 #endif /* TYPES_H */
@@ -0,0 +1,509 @@
+/*									tab:8
+ *
+ * vgaemu.c - software (headless) model of the VGA as used in mode X
+ *
+ * "Copyright (c) 2004-2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    vgaemu.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vgaemu.h"
+
+
+/*
+ * Only the parts of the VGA that the game relies upon are modeled.  Port
+ * writes update shadow copies of the sequencer, CRTC, graphics, and
+ * attribute registers as well as the DAC.  Video memory writes made by
+ * modex.c (copying planes from the build buffer, clearing the screens)
+ * are passed through the sequencer map mask (register 2) into the four
+ * planes.  Text mode writes simply land in a host memory window, which
+ * is never displayed.
+ */
+
+/* port numbers */
+#define ATTR_PORT        0x03C0
+#define ATTR_READ_PORT   0x03C1
+#define MISC_WRITE_PORT  0x03C2
+#define SEQ_INDEX_PORT   0x03C4
+#define SEQ_DATA_PORT    0x03C5
+#define DAC_READ_PORT    0x03C7
+#define DAC_WRITE_PORT   0x03C8
+#define DAC_DATA_PORT    0x03C9
+#define MISC_READ_PORT   0x03CC
+#define GFX_INDEX_PORT   0x03CE
+#define GFX_DATA_PORT    0x03CF
+#define CRTC_INDEX_PORT  0x03D4
+#define CRTC_DATA_PORT   0x03D5
+#define STATUS_PORT      0x03DA
+
+/* register file sizes (rounded up to index masks) */
+#define NUM_SEQ_REGS     8
+#define NUM_CRTC_REGS    32
+#define NUM_GFX_REGS     16
+#define NUM_ATTR_REGS    32
+
+/* CRTC register numbers used to interpret the display */
+#define CRTC_HORIZ_DISP_END   0x01
+#define CRTC_OVERFLOW         0x07
+#define CRTC_MAX_SCAN_LINE    0x09
+#define CRTC_START_HI         0x0C
+#define CRTC_START_LO         0x0D
+#define CRTC_VERT_RETRACE_END 0x11
+#define CRTC_VERT_DISP_END    0x12
+#define CRTC_OFFSET           0x13
+#define CRTC_LINE_COMPARE     0x18
+
+static unsigned char planes[4][VGA_EMU_PLANE_SIZE]; /* video memory planes */
+static unsigned char window[VGA_EMU_WINDOW_SIZE];   /* host memory window  */
+
+static unsigned char seq[NUM_SEQ_REGS];	    /* sequencer registers      */
+static unsigned char crtc[NUM_CRTC_REGS];   /* CRT controller registers */
+static unsigned char gfx[NUM_GFX_REGS];	    /* graphics registers       */
+static unsigned char attr[NUM_ATTR_REGS];   /* attribute registers      */
+static unsigned char misc_output;	    /* miscellaneous output     */
+static int seq_index, crtc_index, gfx_index, attr_index;
+static int attr_flip_flop;		    /* 0 = index next, 1 = data */
+static unsigned char status_toggle;	    /* fake retrace bits        */
+
+static unsigned char dac[256][3];	    /* palette (6-bit RGB)      */
+static int dac_write_index, dac_write_comp; /* DAC write position       */
+static int dac_read_index, dac_read_comp;   /* DAC read position        */
+
+
+/*
+ * vga_emu_init
+ *   DESCRIPTION: Reset the software VGA: zero all registers, video memory,
+ *                and the palette.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: discards all emulated VGA state
+ */
+void
+vga_emu_init ()
+{
+    memset (planes, 0, sizeof (planes));
+    memset (window, 0, sizeof (window));
+    memset (seq, 0, sizeof (seq));
+    memset (crtc, 0, sizeof (crtc));
+    memset (gfx, 0, sizeof (gfx));
+    memset (attr, 0, sizeof (attr));
+    memset (dac, 0, sizeof (dac));
+    misc_output = 0;
+    seq_index = crtc_index = gfx_index = attr_index = 0;
+    attr_flip_flop = 0;
+    status_toggle = 0;
+    dac_write_index = dac_write_comp = 0;
+    dac_read_index = dac_read_comp = 0;
+}
+
+
+/*
+ * vga_emu_window
+ *   DESCRIPTION: Get the host memory that stands in for the mapped video
+ *                memory window.  Only text mode code touches it directly.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to VGA_EMU_WINDOW_SIZE bytes of memory
+ *   SIDE EFFECTS: none
+ */
+unsigned char*
+vga_emu_window ()
+{
+    return window;
+}
+
+
+/*
+ * vga_emu_outb
+ *   DESCRIPTION: Emulate writing one byte to a VGA port.
+ *   INPUTS: port -- the port number
+ *           val -- the byte written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates emulated register or palette state
+ */
+void
+vga_emu_outb (unsigned short port, unsigned char val)
+{
+    switch (port) {
+	case ATTR_PORT:
+	    /* The attribute controller alternates index and data writes. */
+	    if (0 == attr_flip_flop) {
+		attr_index = val & (NUM_ATTR_REGS - 1);
+	    } else {
+		attr[attr_index] = val;
+	    }
+	    attr_flip_flop ^= 1;
+	    break;
+	case MISC_WRITE_PORT:
+	    misc_output = val;
+	    break;
+	case SEQ_INDEX_PORT:
+	    seq_index = val & (NUM_SEQ_REGS - 1);
+	    break;
+	case SEQ_DATA_PORT:
+	    seq[seq_index] = val;
+	    break;
+	case DAC_READ_PORT:
+	    dac_read_index = val;
+	    dac_read_comp = 0;
+	    break;
+	case DAC_WRITE_PORT:
+	    dac_write_index = val;
+	    dac_write_comp = 0;
+	    break;
+	case DAC_DATA_PORT:
+	    /* Red, green, and blue follow in turn, then the index advances. */
+	    dac[dac_write_index][dac_write_comp] = (val & 0x3F);
+	    if (3 == ++dac_write_comp) {
+		dac_write_comp = 0;
+		dac_write_index = (dac_write_index + 1) & 0xFF;
+	    }
+	    break;
+	case GFX_INDEX_PORT:
+	    gfx_index = val & (NUM_GFX_REGS - 1);
+	    break;
+	case GFX_DATA_PORT:
+	    gfx[gfx_index] = val;
+	    break;
+	case CRTC_INDEX_PORT:
+	    crtc_index = val & (NUM_CRTC_REGS - 1);
+	    break;
+	case CRTC_DATA_PORT:
+	    /*
+	     * Bit 7 of the vertical retrace end register write-protects
+	     * CRTC registers 0 through 7, except for the line compare bit
+	     * (bit 4) of the overflow register.
+	     */
+	    if (0 != (crtc[CRTC_VERT_RETRACE_END] & 0x80) &&
+		CRTC_OVERFLOW >= crtc_index) {
+		if (CRTC_OVERFLOW == crtc_index) {
+		    crtc[CRTC_OVERFLOW] = ((crtc[CRTC_OVERFLOW] & ~0x10) |
+					   (val & 0x10));
+		}
+		break;
+	    }
+	    crtc[crtc_index] = val;
+	    break;
+	default:
+	    /* Writes to other ports are ignored. */
+	    break;
+    }
+}
+
+
+/*
+ * vga_emu_outw
+ *   DESCRIPTION: Emulate writing two bytes to two consecutive VGA ports
+ *                (typically an index followed by data).
+ *   INPUTS: port -- the first port number
+ *           val -- low byte goes to port, high byte to port + 1
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates emulated register state
+ */
+void
+vga_emu_outw (unsigned short port, unsigned short val)
+{
+    vga_emu_outb (port, val & 0xFF);
+    vga_emu_outb (port + 1, val >> 8);
+}
+
+
+/*
+ * vga_emu_inb
+ *   DESCRIPTION: Emulate reading one byte from a VGA port.
+ *   INPUTS: port -- the port number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte read
+ *   SIDE EFFECTS: reading the input status port resets the attribute
+ *                 controller to expect an index; reading DAC data
+ *                 advances the DAC read position
+ */
+unsigned char
+vga_emu_inb (unsigned short port)
+{
+    unsigned char val; /* value read */
+
+    switch (port) {
+	case ATTR_READ_PORT:
+	    return attr[attr_index];
+	case SEQ_DATA_PORT:
+	    return seq[seq_index];
+	case DAC_DATA_PORT:
+	    val = dac[dac_read_index][dac_read_comp];
+	    if (3 == ++dac_read_comp) {
+		dac_read_comp = 0;
+		dac_read_index = (dac_read_index + 1) & 0xFF;
+	    }
+	    return val;
+	case MISC_READ_PORT:
+	    return misc_output;
+	case GFX_DATA_PORT:
+	    return gfx[gfx_index];
+	case CRTC_DATA_PORT:
+	    return crtc[crtc_index];
+	case STATUS_PORT:
+	    /* Toggle the retrace bits so that polling loops terminate. */
+	    attr_flip_flop = 0;
+	    status_toggle ^= 0x09;
+	    return status_toggle;
+	default:
+	    return 0xFF;
+    }
+}
+
+
+/*
+ * vga_emu_write
+ *   DESCRIPTION: Copy data into video memory at a mode X address, writing
+ *                each plane enabled in the sequencer map mask.
+ *   INPUTS: addr -- the starting address within each plane
+ *           src -- the data to be written
+ *           len -- the number of bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated video memory; addresses wrap at 64kB
+ */
+void
+vga_emu_write (unsigned short addr, const unsigned char* src, int len)
+{
+    int plane; /* loop index over planes            */
+    int first; /* bytes written before address wrap */
+
+    first = VGA_EMU_PLANE_SIZE - addr;
+    if (first > len) {
+	first = len;
+    }
+    for (plane = 0; 4 > plane; plane++) {
+	if (0 != (seq[2] & (1 << plane))) {
+	    memcpy (planes[plane] + addr, src, first);
+	    memcpy (planes[plane], src + first, len - first);
+	}
+    }
+}
+
+
+/*
+ * vga_emu_fill
+ *   DESCRIPTION: Fill video memory at a mode X address with a single value,
+ *                writing each plane enabled in the sequencer map mask.
+ *   INPUTS: addr -- the starting address within each plane
+ *           val -- the value to write
+ *           len -- the number of bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated video memory; addresses wrap at 64kB
+ */
+void
+vga_emu_fill (unsigned short addr, unsigned char val, int len)
+{
+    int plane; /* loop index over planes            */
+    int first; /* bytes written before address wrap */
+
+    first = VGA_EMU_PLANE_SIZE - addr;
+    if (first > len) {
+	first = len;
+    }
+    for (plane = 0; 4 > plane; plane++) {
+	if (0 != (seq[2] & (1 << plane))) {
+	    memset (planes[plane] + addr, val, first);
+	    memset (planes[plane], val, len - first);
+	}
+    }
+}
+
+
+/*
+ * vga_emu_peek
+ *   DESCRIPTION: Read one byte from one plane of emulated video memory.
+ *   INPUTS: plane -- the plane (0-3)
+ *           addr -- the address within the plane
+ *   OUTPUTS: none
+ *   RETURN VALUE: the byte stored at that address
+ *   SIDE EFFECTS: none
+ */
+unsigned char
+vga_emu_peek (int plane, unsigned short addr)
+{
+    return planes[plane & 3][addr];
+}
+
+
+/*
+ * vga_emu_start_address
+ *   DESCRIPTION: Get the display start address from the CRTC.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the address shown at the top left of the screen
+ *   SIDE EFFECTS: none
+ */
+unsigned short
+vga_emu_start_address ()
+{
+    return ((crtc[CRTC_START_HI] << 8) | crtc[CRTC_START_LO]);
+}
+
+
+/*
+ * vga_emu_line_compare
+ *   DESCRIPTION: Get the ten-bit line compare value, which is spread over
+ *                the line compare, overflow, and maximum scan line
+ *                registers.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the last scan line drawn from the start address; later
+ *                 scan lines restart at video memory address 0
+ *   SIDE EFFECTS: none
+ */
+unsigned short
+vga_emu_line_compare ()
+{
+    return (crtc[CRTC_LINE_COMPARE] |
+	    ((crtc[CRTC_OVERFLOW] & 0x10) << 4) |
+	    ((crtc[CRTC_MAX_SCAN_LINE] & 0x40) << 3));
+}
+
+
+/*
+ * vga_emu_get_frame
+ *   DESCRIPTION: Scan out the displayed image as the CRTC would, honoring
+ *                the start address, the offset (row pitch), scan line
+ *                doubling, and the line compare split.  Pixel panning is
+ *                not modeled.
+ *   INPUTS: none
+ *   OUTPUTS: img -- VGA_EMU_MAX_X_DIM * VGA_EMU_MAX_Y_DIM bytes (at most)
+ *                   of palette indices, one row after another
+ *            *width, *height -- dimensions of the image in pixels
+ *   RETURN VALUE: 0 on success, -1 if the VGA is not in an unchained
+ *                 256-color mode
+ *   SIDE EFFECTS: none
+ */
+int
+vga_emu_get_frame (unsigned char* img, int* width, int* height)
+{
+    int vert_disp_end;  /* last displayed scan line               */
+    int scan_per_row;   /* scan lines per row of pixels           */
+    int line_compare;   /* scan line at which memory restarts at 0 */
+    int pitch;          /* bytes between rows in each plane       */
+    int start;          /* start address for top of screen        */
+    int row_addr;       /* address of current row in each plane   */
+    int scan;           /* first scan line of current row         */
+    int x, y;           /* pixel coordinates                      */
+
+    /* Sequencer chain-4 must be off and 256-color shifting on. */
+    if (0 != (seq[4] & 0x08) || 0 == (gfx[5] & 0x40)) {
+	return -1;
+    }
+
+    /* Each character clock displays four pixels in 256-color mode. */
+    *width = (crtc[CRTC_HORIZ_DISP_END] + 1) * 4;
+    vert_disp_end = (crtc[CRTC_VERT_DISP_END] |
+		     ((crtc[CRTC_OVERFLOW] & 0x02) << 7) |
+		     ((crtc[CRTC_OVERFLOW] & 0x40) << 3));
+    scan_per_row = (crtc[CRTC_MAX_SCAN_LINE] & 0x1F) + 1;
+    if (0 != (crtc[CRTC_MAX_SCAN_LINE] & 0x80)) {
+	scan_per_row *= 2;
+    }
+    *height = (vert_disp_end + 1) / scan_per_row;
+    if (VGA_EMU_MAX_X_DIM < *width) {
+	*width = VGA_EMU_MAX_X_DIM;
+    }
+    if (VGA_EMU_MAX_Y_DIM < *height) {
+	*height = VGA_EMU_MAX_Y_DIM;
+    }
+
+    line_compare = vga_emu_line_compare ();
+    pitch = crtc[CRTC_OFFSET] * 2;
+    start = vga_emu_start_address ();
+
+    for (y = 0; *height > y; y++) {
+	scan = y * scan_per_row;
+	if (scan > line_compare) {
+	    row_addr = ((scan - line_compare - 1) / scan_per_row) * pitch;
+	} else {
+	    row_addr = start + y * pitch;
+	}
+	for (x = 0; *width > x; x++) {
+	    img[y * *width + x] =
+		planes[x & 3][(row_addr + (x >> 2)) & (VGA_EMU_PLANE_SIZE - 1)];
+	}
+    }
+    return 0;
+}
+
+
+/*
+ * vga_emu_get_palette
+ *   DESCRIPTION: Copy the emulated DAC palette.
+ *   INPUTS: none
+ *   OUTPUTS: pal -- the 256 colors as 6-bit red, green, and blue values
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+vga_emu_get_palette (unsigned char pal[256][3])
+{
+    memcpy (pal, dac, sizeof (dac));
+}
+
+
+/*
+ * vga_emu_save_ppm
+ *   DESCRIPTION: Write the displayed frame, translated through the DAC
+ *                palette, to a binary (P6) PPM file.
+ *   INPUTS: fname -- name of file to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates or overwrites the file
+ */
+int
+vga_emu_save_ppm (const char* fname)
+{
+    static unsigned char img[VGA_EMU_MAX_X_DIM * VGA_EMU_MAX_Y_DIM];
+    FILE*         out;         /* output file             */
+    int           width;       /* frame width in pixels   */
+    int           height;      /* frame height in pixels  */
+    int           i;           /* loop index over pixels  */
+    int           c;           /* loop index over colors  */
+    unsigned char rgb[3];      /* one output pixel        */
+
+    if (0 != vga_emu_get_frame (img, &width, &height) ||
+	NULL == (out = fopen (fname, "wb"))) {
+	return -1;
+    }
+    fprintf (out, "P6\n%d %d\n255\n", width, height);
+    for (i = 0; width * height > i; i++) {
+	/* Scale 6-bit DAC values to 8 bits. */
+	for (c = 0; 3 > c; c++) {
+	    rgb[c] = (dac[img[i]][c] * 255) / 63;
+	}
+	if (1 != fwrite (rgb, sizeof (rgb), 1, out)) {
+	    (void)fclose (out);
+	    return -1;
+	}
+    }
+    return (0 == fclose (out) ? 0 : -1);
+}
@@ -0,0 +1,83 @@
+/*									tab:8
+ *
+ * vgaemu.h - header file for the software (headless) VGA model
+ *
+ * "Copyright (c) 2004-2011 by Steven S. Lumetta."
+ *
+ * Permission to use, copy, modify, and distribute this software and its
+ * documentation for any purpose, without fee, and without written agreement is
+ * hereby granted, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * IN NO EVENT SHALL THE AUTHOR OR THE UNIVERSITY OF ILLINOIS BE LIABLE TO
+ * ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL
+ * DAMAGES ARISING OUT  OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+ * EVEN IF THE AUTHOR AND/OR THE UNIVERSITY OF ILLINOIS HAS BEEN ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THE AUTHOR AND THE UNIVERSITY OF ILLINOIS SPECIFICALLY DISCLAIM ANY
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+ * PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND NEITHER THE AUTHOR NOR
+ * THE UNIVERSITY OF ILLINOIS HAS ANY OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS."
+ *
+ * Filename:	    vgaemu.h
+ */
+
+#ifndef VGAEMU_H
+#define VGAEMU_H
+
+
+/*
+ * The software VGA keeps the state needed to reproduce a mode X display
+ * in ordinary memory: the four 64kB planes, the sequencer, CRTC, graphics
+ * and attribute registers, and the 256-entry DAC palette.  modex.c routes
+ * its port writes and video memory copies here when compiled with
+ * VGA_EMULATION set to 1, so the game can be run and profiled without
+ * ioperm or /dev/mem.
+ */
+
+#define VGA_EMU_PLANE_SIZE  65536   /* bytes in one video memory plane    */
+#define VGA_EMU_WINDOW_SIZE 131072  /* host-visible window (0xA0000 on PC) */
+#define VGA_EMU_MAX_X_DIM   360     /* widest frame produced by snapshots */
+#define VGA_EMU_MAX_Y_DIM   240     /* tallest frame produced by snapshots */
+
+/* reset registers, video memory, and palette to power-on values */
+extern void vga_emu_init ();
+
+/* return the host memory window that stands in for mapped video memory */
+extern unsigned char* vga_emu_window ();
+
+/* port I/O */
+extern void vga_emu_outb (unsigned short port, unsigned char val);
+extern void vga_emu_outw (unsigned short port, unsigned short val);
+extern unsigned char vga_emu_inb (unsigned short port);
+
+/* write or fill video memory through the sequencer map mask */
+extern void vga_emu_write (unsigned short addr, const unsigned char* src,
+			   int len);
+extern void vga_emu_fill (unsigned short addr, unsigned char val, int len);
+
+/* read back a single byte from one plane of video memory */
+extern unsigned char vga_emu_peek (int plane, unsigned short addr);
+
+/* displayed CRTC start address and line compare (split screen) values */
+extern unsigned short vga_emu_start_address ();
+extern unsigned short vga_emu_line_compare ();
+
+/*
+ * Produce the image shown on the monitor as one palette index per pixel,
+ * scanning rows from the top.  Returns 0 on success (with the dimensions
+ * written to *width and *height), or -1 if the registers do not describe
+ * an unchained 256-color mode.
+ */
+extern int vga_emu_get_frame (unsigned char* img, int* width, int* height);
+
+/* copy the DAC palette (6-bit RGB) */
+extern void vga_emu_get_palette (unsigned char pal[256][3]);
+
+/* write the displayed frame to a binary PPM file; returns 0 on success */
+extern int vga_emu_save_ppm (const char* fname);
+
+#endif /* VGAEMU_H */
@@ -34,8 +34,12 @@
  */
  
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "photo.h"
@@ -173,6 +177,96 @@ enum {
 
 /* types local to this file (declared in types.h) */
 
+/*
+ * Image files are read by a pool of worker threads in build_world.  The
+ * pool defaults to one thread per online processor (at most
+ * MAX_LOAD_THREADS); set the LOAD_THREADS environment variable to
+ * override the count.  Each file is one job; the results and per-file
+ * timings are collected in the job array and applied to the world in
+ * data array order once all workers are done, so the world built is
+ * identical to that of a serial load.  Room photos found in the photo
+ * cache (see photo.c) are timed separately as warm loads.
+ */
+#define MAX_LOAD_THREADS 16
+
+/*
+ * With PREFETCH_ROOMS set to 1, build_world instead reads only the sizes
+ * of the photos and images (which object placement needs) and the pixel
+ * data for the starting room.  A prefetch thread then reads the photos
+ * and object images of rooms within PREFETCH_HOPS moves of the room last
+ * passed to room_entered (nearest first), followed by the swap photos
+ * and the images of objects not yet placed in a room.  Anything needed
+ * before the thread gets to it is read on demand by the thread that
+ * asks for it.
+ */
+#if !defined(PREFETCH_ROOMS)
+#define PREFETCH_ROOMS 0
+#endif
+#define PREFETCH_HOPS 2
+
+/*
+ * Room and swap photos are kept within a budget of PHOTO_BUDGET bytes of
+ * pixel data (0 for no limit; the PHOTO_BUDGET environment variable
+ * overrides the default).  When reading a photo would exceed the budget,
+ * the photos least recently shown are dropped, and read again if needed
+ * later.  The photos of the room that the player is in (including its
+ * swap alternate) are never dropped.  When prefetching, the rooms to be
+ * prefetched count as shown, nearest most recently; the prefetch thread
+ * stops rather than drop a photo nearer than the one it would read.
+ */
+#if !defined(PHOTO_BUDGET)
+#define PHOTO_BUDGET 0
+#endif
+
+typedef struct load_job_t load_job_t;
+struct load_job_t {
+    const char* filename;	/* file to read                       */
+    int32_t     is_photo;	/* 1 for a room photo, 0 for an object */
+    photo_t*    photo;		/* result for room photos             */
+    image_t*    image;		/* result for object images           */
+    double      msec;		/* time spent reading the file        */
+    int32_t     state;		/* JOB_* (see below)                  */
+    uint32_t    bytes;		/* photo pixel bytes held in memory   */
+    uint32_t    shown;		/* when photo was last shown           */
+    int32_t     pins;		/* drawers holding photo in memory    */
+};
+
+/* states of a load job */
+enum {
+    JOB_UNREAD,			/* only the image size is known      */
+    JOB_READING,		/* a thread is reading the pixels    */
+    JOB_READ			/* pixels read (or reading failed)   */
+};
+
+/* all files to be read: rooms, then objects, then swap photos */
+#define N_LOAD_JOBS (N_ROOMS + N_OBJECTS + N_SWAPS)
+
+/*
+ * Each room indexes its objects by the rows and the columns of its photo
+ * that they cover, so that drawing a line need only look at the objects
+ * that might cross it.  The rows are grouped into bands of OBJ_BAND_DIM
+ * rows, and the columns likewise.  Each band has a list of the objects
+ * that overlap it, kept in the same order as the room's contents (most
+ * recently placed first) so that objects are drawn in the same order
+ * either way.  Objects beyond the largest photo are put in the last
+ * band.  An object overlaps at most OBJ_ROW_LINKS row bands and
+ * OBJ_COL_LINKS column bands, and has a list link for each.
+ */
+#define OBJ_BAND_SHIFT 5
+#define OBJ_BAND_DIM   (1 << OBJ_BAND_SHIFT)
+#define OBJ_ROW_BANDS  (MAX_PHOTO_HEIGHT >> OBJ_BAND_SHIFT)
+#define OBJ_COL_BANDS  (MAX_PHOTO_WIDTH >> OBJ_BAND_SHIFT)
+#define OBJ_BANDS_CROSSED(len) (((len) + OBJ_BAND_DIM - 2) / OBJ_BAND_DIM + 1)
+#define OBJ_ROW_LINKS  OBJ_BANDS_CROSSED (MAX_OBJECT_HEIGHT)
+#define OBJ_COL_LINKS  OBJ_BANDS_CROSSED (MAX_OBJECT_WIDTH)
+
+struct obj_link_t {
+    object_t*    obj;		/* object overlapping band        */
+    obj_link_t*  next;		/* next object in band, or NULL   */
+    obj_link_t** prev;		/* pointer to this link, or NULL  */
+				/*    if not in a band            */
+};
+
 /*
  * The structure representing a room in the world.  The backpack/inventory 
  * is also a 'room' (#0, R_INVENTORY). 
@@ -184,6 +278,11 @@ struct room_t {
     room_t*     left;   	/* room to the "left"             */
     room_t*     enter;  	/* doors, etc.                    */
     room_t*     right;  	/* room to the "right"            */
+    load_job_t* view_job;	/* job that reads view            */
+    int32_t     swap;		/* id of swap alternate, or -1    */
+    uint32_t    version;	/* changes when the room's look does */
+    obj_link_t* row_band[OBJ_ROW_BANDS]; /* objects by rows       */
+    obj_link_t* col_band[OBJ_COL_BANDS]; /* objects by columns    */
 };
 
 /*
@@ -197,6 +296,10 @@ struct object_t {
     room_t*      loc;      	/* in what 'room'?                */
     uint16_t     x, y;    	/* location within room photo     */
     image_t*     img;     	/* image for use in room          */
+    load_job_t*  img_job;	/* job that reads img             */
+    uint32_t     placed;	/* when placed (later is larger)  */
+    obj_link_t   row_link[OBJ_ROW_LINKS]; /* links in row bands   */
+    obj_link_t   col_link[OBJ_COL_LINKS]; /* links in column bands */
 };
 
 /*
@@ -412,19 +515,25 @@ static const obj_data_t obj_data[N_OBJECTS] = {
 typedef struct swap_data_t swap_data_t;
 struct swap_data_t {
     int32_t id;
+    int32_t room;		/* room in which photo is swapped */
     const char* const filename;
 };
 
 /* the swap photo descriptions */
 static const swap_data_t swap_data[N_SWAPS] = {
-    {SWAP_CIRCLE, "images/circlen2.photo"},	/* alternate for Boneyard */
-    {SWAP_CAR, "images/caropen.photo"}		/* open/closed car photos */
+    {SWAP_CIRCLE, R_CIRCLE_N, "images/circlen2.photo"},	/* for Boneyard */
+    {SWAP_CAR, R_CAR_SITE, "images/caropen.photo"}	/* open/closed car */
 };
 
 
 /* functions local to this file--see function headers for details */
 static void do_photo_swap (room_t* r, int32_t which);
 static object_t* find_in_room (const room_t* r, const char* arg);
+static int32_t band_of (int32_t pos, int32_t n_bands);
+static void index_object (object_t* o);
+static void unindex_object (object_t* o);
+static void unlink_band (obj_link_t* link);
+static void mark_dirty (const object_t* o);
 static void insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y);
 static void insert_object (object_t* o, room_t* r);
 static void move_object_to_inventory (object_t* obj);
@@ -432,6 +541,20 @@ static object_t* obj_special_get (room_t* r, const char* arg);
 static int32_t player_flag_is_set (int32_t fnum);
 static void player_set_flag (int32_t fnum);
 static void remove_object (object_t* o);
+static double elapsed_msec (const struct timespec* start);
+static int32_t photo_is_pinned (const load_job_t* job);
+static int32_t make_room_for (uint32_t bytes, uint32_t shown);
+static void claim_job (load_job_t* job);
+static void read_job (load_job_t* job);
+static void ensure_read (load_job_t* job);
+#if (1 != PREFETCH_ROOMS)
+static void* load_worker (void* ignore);
+static void run_load_jobs (void);
+#else /* PREFETCH_ROOMS */
+static void* prefetch_thread (void* ignore);
+static void read_sizes (void);
+static void start_prefetch (room_t* start);
+#endif /* PREFETCH_ROOMS */
 
 
 /* file-scope variables */
@@ -444,6 +567,46 @@ static room_t   room[N_ROOMS];			     /* rooms                */
 static object_t object[N_OBJECTS];		     /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
 static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static load_job_t* swap_job[N_SWAPS];		     /* jobs for swap photos */
+static uint32_t n_placed;			     /* objects placed       */
+static dirty_rect_t dirty_rect[MAX_DIRTY_RECTS];     /* changed areas        */
+static int32_t  n_dirty;			     /* rectangles recorded  */
+static int32_t  dirty_all;			     /* redraw whole room?   */
+
+/* image loading jobs, and the index of the next job to be claimed */
+static load_job_t      load_job[N_LOAD_JOBS];
+#if (1 != PREFETCH_ROOMS)
+static int32_t         next_load_job;
+#endif /* !PREFETCH_ROOMS */
+static pthread_mutex_t load_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* signalled whenever a job finishes or the prefetch list changes */
+static pthread_cond_t  load_job_cv = PTHREAD_COND_INITIALIZER;
+
+#if (1 == PREFETCH_ROOMS)
+/* 
+ * Jobs for the prefetch thread, in the order to be read, and the index 
+ * of the next to be read.
+ */
+static load_job_t*     prefetch_list[N_LOAD_JOBS];
+static int32_t         n_prefetch;
+static int32_t         next_prefetch;
+#endif /* PREFETCH_ROOMS */
+
+/*
+ * Photo residency (see PHOTO_BUDGET): the budget, the bytes of photo
+ * pixels held (or being read), the room that the player is in, the
+ * clock used to order photos by when they were shown, and counts of
+ * rooms entered with their photo in memory (hits) or not (misses) and
+ * of photos dropped.  All but the budget are protected by load_job_lock.
+ */
+static uint32_t      photo_budget;
+static uint32_t      photo_bytes;
+static const room_t* cur_room;
+static uint32_t      show_clock;
+static uint32_t      photo_hits;
+static uint32_t      photo_misses;
+static uint32_t      photo_evictions;
 
 
 /* 
@@ -453,17 +616,28 @@ static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
  *	     which -- index into array of stored photos
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: marks the whole room for redrawing if it is the current
+ *                 room
  */
 static void
 do_photo_swap (room_t* r, int32_t which)
 {
-    photo_t* tmp;	/* temporary variable to help with swap */
+    photo_t*    tmp;	/* temporary variable to help with swap */
+    load_job_t* tmp_job;	/* temporary variable to help with swap */
 
-    /* Swap the photos. */
+    /* Swap the photos (and the jobs that read them). */
     tmp               = r->view;
     r->view           = swap_photo[which];
     swap_photo[which] = tmp;
+    tmp_job           = r->view_job;
+    r->view_job       = swap_job[which];
+    swap_job[which]   = tmp_job;
+
+    /* The player sees a new photo. */
+    r->version++;
+    if (r == cur_room) {
+        dirty_all = 1;
+    }
 }
 
 
@@ -507,7 +681,8 @@ find_in_room (const room_t* r, const char* arg)
  *           y -- the y position for the object
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: takes the object out of its current location
+ *   SIDE EFFECTS: takes the object out of its current location; marks
+ *                 where it is placed for redrawing (see mark_dirty)
  */
 static void 
 insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
@@ -519,10 +694,205 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     o->x = x;
     o->y = y;
 
-    /* Now add the object to the new room's contents. */
+    /* Now add the object to the new room's contents and index. */
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    o->placed = ++n_placed;
+    index_object (o);
+    mark_dirty (o);
+}
+
+
+/* 
+ * band_of
+ *   DESCRIPTION: Find the band of the object index (see OBJ_BAND_DIM)
+ *                that holds a row or column of a room photo.
+ *   INPUTS: pos -- the row or column (non-negative)
+ *           n_bands -- number of bands (OBJ_ROW_BANDS or OBJ_COL_BANDS)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the band index
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+band_of (int32_t pos, int32_t n_bands)
+{
+    return ((pos >> OBJ_BAND_SHIFT) < n_bands ? 
+	    (pos >> OBJ_BAND_SHIFT) : n_bands - 1);
+}
+
+
+/* 
+ * index_object
+ *   DESCRIPTION: Add an object to the row and column bands of its room
+ *                that its image overlaps.  The object must have just been
+ *                added to the front of the room's contents, and so goes
+ *                to the front of each band.
+ *   INPUTS: o -- the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: links the object into its room's bands
+ */
+static void
+index_object (object_t* o)
+{
+    int32_t      first;	/* first band overlapped         */
+    int32_t      last;	/* last band overlapped          */
+    int32_t      idx;	/* loop index over links         */
+    obj_link_t*  link;	/* link for one band             */
+    obj_link_t** head;	/* head of list for one band     */
+
+    /* Images of no height (or width) overlap nothing. */
+    if (0 == image_height (o->img) || 0 == image_width (o->img)) {
+        return;
+    }
+
+    /* Link into the row bands... */
+    first = band_of (o->y, OBJ_ROW_BANDS);
+    last = band_of (o->y + image_height (o->img) - 1, OBJ_ROW_BANDS);
+    for (idx = 0; last - first >= idx; idx++) {
+	link = &o->row_link[idx];
+	head = &o->loc->row_band[first + idx];
+	link->obj = o;
+	link->next = *head;
+	link->prev = head;
+	if (NULL != *head) {
+	    (*head)->prev = &link->next;
+	}
+	*head = link;
+    }
+
+    /* ...and into the column bands. */
+    first = band_of (o->x, OBJ_COL_BANDS);
+    last = band_of (o->x + image_width (o->img) - 1, OBJ_COL_BANDS);
+    for (idx = 0; last - first >= idx; idx++) {
+	link = &o->col_link[idx];
+	head = &o->loc->col_band[first + idx];
+	link->obj = o;
+	link->next = *head;
+	link->prev = head;
+	if (NULL != *head) {
+	    (*head)->prev = &link->next;
+	}
+	*head = link;
+    }
+}
+
+
+/* 
+ * unindex_object
+ *   DESCRIPTION: Take an object out of all bands of its room.
+ *   INPUTS: o -- the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unlinks the object from its room's bands
+ */
+static void
+unindex_object (object_t* o)
+{
+    int32_t idx;	/* loop index over links */
+
+    for (idx = 0; OBJ_ROW_LINKS > idx; idx++) {
+        unlink_band (&o->row_link[idx]);
+    }
+    for (idx = 0; OBJ_COL_LINKS > idx; idx++) {
+        unlink_band (&o->col_link[idx]);
+    }
+}
+
+
+/* 
+ * unlink_band
+ *   DESCRIPTION: Take one of an object's links out of its band, if it is
+ *                in one.
+ *   INPUTS: link -- the link
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unlinks the link from its band
+ */
+static void
+unlink_band (obj_link_t* link)
+{
+    if (NULL != link->prev) {
+	*link->prev = link->next;
+	if (NULL != link->next) {
+	    link->next->prev = link->prev;
+	}
+	link->prev = NULL;
+    }
+}
+
+
+/* 
+ * mark_dirty
+ *   DESCRIPTION: Record that the area covered by an object's image has
+ *                changed: the object's room looks different (see
+ *                room_version), and if it is the current room, the area
+ *                must be redrawn (see MAX_DIRTY_RECTS).
+ *   INPUTS: o -- the object, placed in or about to leave its room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the version of the object's room; adds to or
+ *                 grows the current room's dirty rectangles
+ */
+static void
+mark_dirty (const object_t* o)
+{
+    int32_t       x1, y1;	/* upper left of object image      */
+    int32_t       x2, y2;	/* just past lower right of image  */
+    dirty_rect_t* d;		/* rectangle grown (or added)      */
+    int32_t       idx;		/* loop index over rectangles      */
+
+    o->loc->version++;
+    if (cur_room != o->loc || 0 == image_height (o->img) ||
+        0 == image_width (o->img)) {
+        return;
+    }
+    x1 = o->x;
+    y1 = o->y;
+    x2 = x1 + (int32_t)image_width (o->img);
+    y2 = y1 + (int32_t)image_height (o->img);
+
+    /* Find a rectangle that overlaps or touches the image... */
+    for (idx = 0; n_dirty > idx; idx++) {
+	d = &dirty_rect[idx];
+	if (x1 <= d->x + d->w && d->x <= x2 && 
+	    y1 <= d->y + d->h && d->y <= y2) {
+	    break;
+	}
+    }
+
+    /* ...or add one if there is space (else grow the last one). */
+    if (n_dirty == idx) {
+	if (MAX_DIRTY_RECTS > n_dirty) {
+	    d = &dirty_rect[n_dirty++];
+	    d->x = x1;
+	    d->y = y1;
+	    d->w = x2 - x1;
+	    d->h = y2 - y1;
+	    return;
+	}
+	idx = MAX_DIRTY_RECTS - 1;
+    }
+    d = &dirty_rect[idx];
+
+    /* Grow the rectangle to cover the image. */
+    if (x1 > d->x) {
+        x1 = d->x;
+    }
+    if (y1 > d->y) {
+        y1 = d->y;
+    }
+    if (x2 < d->x + d->w) {
+        x2 = d->x + d->w;
+    }
+    if (y2 < d->y + d->h) {
+        y2 = d->y + d->h;
+    }
+    d->x = x1;
+    d->y = y1;
+    d->w = x2 - x1;
+    d->h = y2 - y1;
 }
 
 
@@ -688,7 +1058,8 @@ player_set_flag (int32_t fnum)
  *   INPUTS: o -- the object
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: marks where the object was for redrawing (see
+ *                 mark_dirty)
  */
 static void
 remove_object (object_t* o)
@@ -707,7 +1078,9 @@ remove_object (object_t* o)
 	    }
 	}
 
-	/* Mark the object's location as NULL. */
+	/* Take it out of the room's index, and mark its location NULL. */
+	unindex_object (o);
+	mark_dirty (o);
 	o->loc = NULL;
     }
 }
@@ -749,11 +1122,12 @@ obj_get_y (const object_t* obj)
  *   INPUTS: obj -- pointer to the object
  *   OUTPUTS: none
  *   RETURN VALUE: the object obj's image pointer
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: reads the image if it is not in memory
  */
 image_t*
 obj_image (const object_t* obj)
 {
+    ensure_read (obj->img_job);
     return obj->img;
 }
 
@@ -791,6 +1165,140 @@ room_contents_iterate (const room_t* r)
 }
 
 
+/* 
+ * room_row_iterate
+ *   DESCRIPTION: Get the first of the objects in a room whose images may
+ *                overlap a row of the room photo.  Use with link_next and
+ *                link_object to iterate over them in the same order as
+ *                room_contents_iterate.  Objects that do not overlap the
+ *                row may be included.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: none
+ *   RETURN VALUE: a link to the first such object (NULL if none)
+ *   SIDE EFFECTS: none
+ */
+const obj_link_t*
+room_row_iterate (const room_t* r, int32_t y)
+{
+    return (0 > y ? NULL : r->row_band[band_of (y, OBJ_ROW_BANDS)]);
+}
+
+
+/* 
+ * room_col_iterate
+ *   DESCRIPTION: Get the first of the objects in a room whose images may
+ *                overlap a column of the room photo.  Use with link_next
+ *                and link_object to iterate over them in the same order
+ *                as room_contents_iterate.  Objects that do not overlap
+ *                the column may be included.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the column
+ *   OUTPUTS: none
+ *   RETURN VALUE: a link to the first such object (NULL if none)
+ *   SIDE EFFECTS: none
+ */
+const obj_link_t*
+room_col_iterate (const room_t* r, int32_t x)
+{
+    return (0 > x ? NULL : r->col_band[band_of (x, OBJ_COL_BANDS)]);
+}
+
+
+/* 
+ * link_next
+ *   DESCRIPTION: Get the link to the next object in the same row or
+ *                column band (see room_row_iterate).
+ *   INPUTS: link -- the link
+ *   OUTPUTS: none
+ *   RETURN VALUE: the next link (NULL if link is last)
+ *   SIDE EFFECTS: none
+ */
+const obj_link_t*
+link_next (const obj_link_t* link)
+{
+    return link->next;
+}
+
+
+/* 
+ * link_object
+ *   DESCRIPTION: Get the object for a link (see room_row_iterate).
+ *   INPUTS: link -- the link
+ *   OUTPUTS: none
+ *   RETURN VALUE: the object
+ *   SIDE EFFECTS: none
+ */
+object_t*
+link_object (const obj_link_t* link)
+{
+    return link->obj;
+}
+
+
+/* 
+ * room_objects_in_rect
+ *   DESCRIPTION: Find the objects in a room whose images overlap a
+ *                rectangle of the room photo, in the same order as
+ *                room_contents_iterate.
+ *   INPUTS: r -- pointer to the room
+ *           (x,y) -- upper left corner of the rectangle
+ *           (w,h) -- width and height of the rectangle
+ *           max -- the most objects to return
+ *   OUTPUTS: found -- the first max of the objects found
+ *   RETURN VALUE: the number of objects overlapping the rectangle (which
+ *                 may be more than max)
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_objects_in_rect (const room_t* r, int32_t x, int32_t y, int32_t w, 
+		      int32_t h, object_t** found, int32_t max)
+{
+    int32_t           first;	/* first row band overlapped          */
+    int32_t           last;	/* last row band overlapped           */
+    int32_t           band;	/* loop index over row bands          */
+    const obj_link_t* link;	/* loop index over objects in band    */
+    object_t*         o;	/* an object in the band              */
+    int32_t           n = 0;	/* number of objects found            */
+    int32_t           pos;	/* where an object goes in found      */
+
+    if (0 >= w || 0 >= h || 0 > x + w - 1 || 0 > y + h - 1) {
+        return 0;
+    }
+    first = band_of (0 > y ? 0 : y, OBJ_ROW_BANDS);
+    last = band_of (y + h - 1, OBJ_ROW_BANDS);
+    for (band = first; last >= band; band++) {
+	for (link = r->row_band[band]; NULL != link; link = link->next) {
+	    o = link->obj;
+
+	    /* 
+	     * An object in several of the bands is counted in the first
+	     * of them, and only if it overlaps the rectangle.
+	     */
+	    if (band != (first > band_of (o->y, OBJ_ROW_BANDS) ? 
+			 first : band_of (o->y, OBJ_ROW_BANDS)) ||
+	        x + w <= o->x || x >= o->x + (int32_t)image_width (o->img) ||
+		y + h <= o->y || y >= o->y + (int32_t)image_height (o->img)) {
+		continue;
+	    }
+
+	    /* Insert it in order, most recently placed first. */
+	    for (pos = (n < max ? n : max); 0 < pos && 
+		 found[pos - 1]->placed < o->placed; pos--) {
+		if (max > pos) {
+		    found[pos] = found[pos - 1];
+		}
+	    }
+	    if (max > pos) {
+		found[pos] = o;
+	    }
+	    n++;
+	}
+    }
+    return n;
+}
+
+
 /* 
  * room_name
  *   DESCRIPTION: Get name for a room.
@@ -812,15 +1320,144 @@ room_name (const room_t* r)
  *   INPUTS: r -- pointer to the room
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to room r's photo
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: reads the photo if it is not in memory
  */
 photo_t*
 room_photo (const room_t* r)
 {
+    ensure_read (r->view_job);
     return r->view;
 }
 
 
+/* 
+ * room_version
+ *   DESCRIPTION: Get a number that changes whenever the look of a room
+ *                changes (objects placed in it or taken from it, or its
+ *                photo swapped), so that an image of the room can be
+ *                checked for being current.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: the version of room r
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+room_version (const room_t* r)
+{
+    return r->version;
+}
+
+
+/* 
+ * room_neighbors
+ *   DESCRIPTION: Get the rooms one move (left, enter, or right) from a
+ *                room.  The player may not be able to make a move yet.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: near -- the rooms to the left, through the door, and to the
+ *                    right of room r (NULL where there is no room)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+room_neighbors (const room_t* r, const room_t* near[3])
+{
+    near[0] = r->left;
+    near[1] = r->enter;
+    near[2] = r->right;
+}
+
+
+/* 
+ * pin_room_photo
+ *   DESCRIPTION: Keep a room's photo in memory (see PHOTO_BUDGET) so that
+ *                the room can be drawn although the player is not in it,
+ *                provided that the photo has already been read.  The 
+ *                photo is never read here.  Each successful call must be
+ *                matched by a call to unpin_room_photo, and the room's
+ *                photo must not be swapped in between.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the photo is in memory and pinned, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t
+pin_room_photo (const room_t* r)
+{
+    int32_t pinned; /* is the photo pinned? */
+
+    (void)pthread_mutex_lock (&load_job_lock);
+    if (0 != (pinned = (JOB_READ == r->view_job->state))) {
+        r->view_job->pins++;
+    }
+    (void)pthread_mutex_unlock (&load_job_lock);
+    return pinned;
+}
+
+
+/* 
+ * unpin_room_photo
+ *   DESCRIPTION: Allow a room's photo pinned by pin_room_photo to be 
+ *                dropped from memory again.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+unpin_room_photo (const room_t* r)
+{
+    (void)pthread_mutex_lock (&load_job_lock);
+    r->view_job->pins--;
+    (void)pthread_mutex_unlock (&load_job_lock);
+}
+
+
+/* 
+ * read_room_images
+ *   DESCRIPTION: Make sure that the photo and object images of a room
+ *                are in memory without holding the caller's lock while
+ *                reading them.  The jobs to be read are found while the
+ *                lock is held, since a photo swap or a player command
+ *                may change them.
+ *   INPUTS: r -- pointer to the room
+ *           lock -- mutex held by the caller that keeps the room from
+ *                   changing
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if all were in memory (the lock is held throughout),
+ *                 or 1 if some were read (the lock was released, and the
+ *                 room may have changed meanwhile)
+ *   SIDE EFFECTS: may read files and block the caller
+ */
+int32_t
+read_room_images (const room_t* r, pthread_mutex_t* lock)
+{
+    load_job_t*     unread[N_LOAD_JOBS]; /* jobs not yet read     */
+    int32_t         n_unread = 0;	/* number of such jobs   */
+    const object_t* obj;		/* index over contents   */
+    int32_t         idx;		/* index over unread     */
+
+    if (JOB_READ != __atomic_load_n (&r->view_job->state, __ATOMIC_ACQUIRE)) {
+        unread[n_unread++] = r->view_job;
+    }
+    for (obj = r->contents; NULL != obj; obj = obj->next) {
+	if (JOB_READ != __atomic_load_n (&obj->img_job->state, 
+					 __ATOMIC_ACQUIRE)) {
+	    unread[n_unread++] = obj->img_job;
+	}
+    }
+    if (0 == n_unread) {
+        return 0;
+    }
+
+    (void)pthread_mutex_unlock (lock);
+    for (idx = 0; n_unread > idx; idx++) {
+        ensure_read (unread[idx]);
+    }
+    (void)pthread_mutex_lock (lock);
+    return 1;
+}
+
+
 /* 
  * room_photo_height
  *   DESCRIPTION: Get height of room photo in pixels for a room.
@@ -851,11 +1488,439 @@ room_photo_width (const room_t* r)
 }
 
 
+/* 
+ * elapsed_msec
+ *   DESCRIPTION: Measure the time elapsed since a starting time.
+ *   INPUTS: start -- the starting time (CLOCK_MONOTONIC)
+ *   OUTPUTS: none
+ *   RETURN VALUE: milliseconds elapsed since start
+ *   SIDE EFFECTS: none
+ */
+static double
+elapsed_msec (const struct timespec* start)
+{
+    struct timespec now;	/* current time */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000.0 + 
+	    (now.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+
+/* 
+ * photo_is_pinned
+ *   DESCRIPTION: Check whether a job's photo belongs to the room that the
+ *                player is in (either the photo shown or the room's swap
+ *                alternate) or is being drawn (see pin_room_photo), and
+ *                so must stay in memory.  The caller must hold 
+ *                load_job_lock.
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the photo must stay, or 0 if it may be dropped
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+photo_is_pinned (const load_job_t* job)
+{
+    return (0 != job->pins ||
+	    (NULL != cur_room && 
+	     (job == cur_room->view_job || 
+	      (-1 != cur_room->swap && job == swap_job[cur_room->swap]))));
+}
+
+
+/* 
+ * make_room_for
+ *   DESCRIPTION: Drop photos, least recently shown first, until another
+ *                photo of a given size fits in the photo budget.  Only
+ *                photos shown before a given time are dropped, and the
+ *                photos of the current room are never dropped.  The
+ *                caller must hold load_job_lock.
+ *                Callers of ensure_read hold no reference to a photo
+ *                that keeps it in memory, so dropping is safe only
+ *                because every photo read outside load_job_lock is
+ *                pinned (see photo_is_pinned).
+ *   INPUTS: bytes -- size of photo to be read (0 to simply trim)
+ *           shown -- drop only photos last shown before this time
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the photo fits, or 0 if not
+ *   SIDE EFFECTS: frees photo pixel data
+ */
+static int32_t
+make_room_for (uint32_t bytes, uint32_t shown)
+{
+    load_job_t* victim;	/* photo to drop    */
+    int32_t     idx;	/* index over jobs  */
+
+    if (0 == photo_budget) {
+        return 1;
+    }
+    while (photo_budget < photo_bytes + bytes) {
+	victim = NULL;
+	for (idx = 0; N_LOAD_JOBS > idx; idx++) {
+	    if (0 != load_job[idx].bytes && JOB_READ == load_job[idx].state &&
+		shown > load_job[idx].shown && 
+		!photo_is_pinned (&load_job[idx]) &&
+		(NULL == victim || victim->shown > load_job[idx].shown)) {
+		victim = &load_job[idx];
+	    }
+	}
+	if (NULL == victim) {
+	    return 0;
+	}
+	free_photo_pixels (victim->photo);
+	photo_bytes -= victim->bytes;
+	victim->bytes = 0;
+	__atomic_store_n (&victim->state, JOB_UNREAD, __ATOMIC_RELEASE);
+	photo_evictions++;
+    }
+    return 1;
+}
+
+
+/* 
+ * claim_job
+ *   DESCRIPTION: Mark a job as being read, counting its photo (if any)
+ *                against the photo budget.  The caller must hold 
+ *                load_job_lock and must then call read_job.
+ *   INPUTS: job -- the job (in state JOB_UNREAD)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes job state
+ */
+static void
+claim_job (load_job_t* job)
+{
+    job->state = JOB_READING;
+    if (job->is_photo) {
+	job->bytes = PHOTO_TILED_SIZE (photo_width (job->photo), 
+				       photo_height (job->photo));
+	photo_bytes += job->bytes;
+    }
+}
+
+
+/* 
+ * read_job
+ *   DESCRIPTION: Read the pixel data for a load job whose image size has
+ *                already been read and which has been claimed by the
+ *                caller (see claim_job).
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the job as read and wakes up any waiting threads;
+ *                 prints an error message to stderr on failure (the photo
+ *                 or image is then drawn as blank)
+ */
+static void
+read_job (load_job_t* job)
+{
+    struct timespec start;	/* start time of job  */
+    int32_t         failed;	/* did the read fail? */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    if (job->is_photo) {
+	failed = (0 != read_photo_pixels (job->photo, job->filename));
+    } else {
+	failed = (0 != read_obj_image_pixels (job->image, job->filename));
+    }
+    job->msec = elapsed_msec (&start);
+    if (failed) {
+	fprintf (stderr, "Can't read %s %s.\n", 
+		 (job->is_photo ? "room photo" : "object photo"), 
+		 job->filename);
+    }
+
+    (void)pthread_mutex_lock (&load_job_lock);
+    if (failed) {
+	photo_bytes -= job->bytes;
+	job->bytes = 0;
+    }
+    __atomic_store_n (&job->state, JOB_READ, __ATOMIC_RELEASE);
+    (void)pthread_cond_broadcast (&load_job_cv);
+    (void)pthread_mutex_unlock (&load_job_lock);
+}
+
+
+/* 
+ * ensure_read
+ *   DESCRIPTION: Make sure that the pixel data for a load job are in
+ *                memory, reading them in the calling thread if no other
+ *                thread has started to do so, or waiting for the other
+ *                thread otherwise.
+ *   INPUTS: job -- the job
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may read a file (dropping other photos to make room)
+ *                 and block the caller
+ */
+static void
+ensure_read (load_job_t* job)
+{
+    /* Most calls find the job done; skip the lock in that case. */
+    if (JOB_READ == __atomic_load_n (&job->state, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    (void)pthread_mutex_lock (&load_job_lock);
+    if (JOB_UNREAD == job->state) {
+	if (job->is_photo) {
+	    (void)make_room_for (PHOTO_TILED_SIZE (photo_width (job->photo),
+						   photo_height (job->photo)),
+				 UINT32_MAX);
+	}
+	claim_job (job);
+	(void)pthread_mutex_unlock (&load_job_lock);
+	read_job (job);
+	return;
+    }
+    while (JOB_READ != job->state) {
+	(void)pthread_cond_wait (&load_job_cv, &load_job_lock);
+    }
+    (void)pthread_mutex_unlock (&load_job_lock);
+}
+
+
+#if (1 != PREFETCH_ROOMS)
+/* 
+ * load_worker
+ *   DESCRIPTION: Body of an image loading thread.  Claims jobs from the
+ *                load_job array one at a time and reads the files that
+ *                they name until no jobs remain.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in results and timings of claimed jobs
+ */
+static void*
+load_worker (void* ignore)
+{
+    load_job_t*     job;	/* job being run      */
+    struct timespec start;	/* start time of job  */
+
+    while (1) {
+	/* Claim the next job, if any. */
+	(void)pthread_mutex_lock (&load_job_lock);
+	job = (N_LOAD_JOBS > next_load_job ? &load_job[next_load_job++] : NULL);
+	(void)pthread_mutex_unlock (&load_job_lock);
+	if (NULL == job) {
+	    return NULL;
+	}
+
+	/* Read the file, timing the read. */
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	if (job->is_photo) {
+	    job->photo = read_photo (job->filename);
+	} else {
+	    job->image = read_obj_image (job->filename);
+	}
+	job->msec = elapsed_msec (&start);
+	job->state = JOB_READ;
+    }
+}
+
+
+/* 
+ * run_load_jobs
+ *   DESCRIPTION: Read all files named in the load_job array using a pool
+ *                of worker threads, returning once every job is done.
+ *                Prints the time taken for each file and for the whole
+ *                load.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in results and timings of all jobs; falls back to
+ *                 loading in the calling thread if no thread can be made
+ */
+static void
+run_load_jobs ()
+{
+    pthread_t       worker[MAX_LOAD_THREADS]; /* pool threads          */
+    int32_t         n_threads;		      /* size of pool          */
+    int32_t         n_started;		      /* threads running       */
+    const char*     env;		      /* LOAD_THREADS override */
+    struct timespec start;		      /* start of whole load   */
+    int32_t         idx;		      /* index over jobs       */
+    const char*     kind;		      /* kind of load for job  */
+    double          msec[3];		      /* time by kind of load  */
+    int32_t         count[3];		      /* jobs by kind of load  */
+
+    /* Pick the number of threads. */
+    n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (NULL != (env = getenv ("LOAD_THREADS"))) {
+        n_threads = atoi (env);
+    }
+    if (1 > n_threads) {
+        n_threads = 1;
+    } else if (MAX_LOAD_THREADS < n_threads) {
+        n_threads = MAX_LOAD_THREADS;
+    }
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    next_load_job = 0;
+    for (n_started = 0; n_threads > n_started; n_started++) {
+	if (0 != pthread_create (&worker[n_started], NULL, load_worker, NULL)) {
+	    break;
+	}
+    }
+
+    /* Help out (or do everything, if no thread started), then wait. */
+    (void)load_worker (NULL);
+    for (idx = 0; n_started > idx; idx++) {
+	(void)pthread_join (worker[idx], NULL);
+    }
+
+    /* 
+     * Report times for each file and totals for cold (quantized) photos, 
+     * warm (cached) photos, and object images.
+     */
+    (void)memset (msec, 0, sizeof (msec));
+    (void)memset (count, 0, sizeof (count));
+    for (idx = 0; N_LOAD_JOBS > idx; idx++) {
+	if (!load_job[idx].is_photo) {
+	    kind = "object";
+	    msec[2] += load_job[idx].msec;
+	    count[2]++;
+	} else if (NULL != load_job[idx].photo && 
+		   photo_from_cache (load_job[idx].photo)) {
+	    kind = "warm";
+	    msec[1] += load_job[idx].msec;
+	    count[1]++;
+	} else {
+	    kind = "cold";
+	    msec[0] += load_job[idx].msec;
+	    count[0]++;
+	}
+        printf ("%8.2f ms  %-6s %s\n", load_job[idx].msec, kind, 
+		load_job[idx].filename);
+    }
+    printf ("%8.2f ms  cold photos (%d)\n", msec[0], count[0]);
+    printf ("%8.2f ms  warm photos (%d)\n", msec[1], count[1]);
+    printf ("%8.2f ms  object images (%d)\n", msec[2], count[2]);
+    printf ("%8.2f ms  total for %d files (%d threads)\n", 
+	    elapsed_msec (&start), N_LOAD_JOBS, n_started > 0 ? n_started : 1);
+}
+
+#else /* PREFETCH_ROOMS */
+
+/* 
+ * prefetch_thread
+ *   DESCRIPTION: Body of the prefetch thread.  Reads the jobs in the
+ *                prefetch list in order, skipping those already read or
+ *                being read, and waits for a new list when done.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: reads files
+ */
+static void*
+prefetch_thread (void* ignore)
+{
+    load_job_t* job;	/* job being read */
+
+    (void)pthread_mutex_lock (&load_job_lock);
+    while (1) {
+	if (n_prefetch <= next_prefetch) {
+	    (void)pthread_cond_wait (&load_job_cv, &load_job_lock);
+	    continue;
+	}
+	job = prefetch_list[next_prefetch++];
+	if (JOB_UNREAD != job->state) {
+	    continue;
+	}
+
+	/* Stop when the rest of the list would push out nearer photos. */
+	if (job->is_photo &&
+	    !make_room_for (PHOTO_TILED_SIZE (photo_width (job->photo),
+					      photo_height (job->photo)),
+			    job->shown)) {
+	    next_prefetch = n_prefetch;
+	    continue;
+	}
+	claim_job (job);
+	(void)pthread_mutex_unlock (&load_job_lock);
+	read_job (job);
+	(void)pthread_mutex_lock (&load_job_lock);
+    }
+
+    /* not reached */
+    return NULL;
+}
+
+
+/* 
+ * read_sizes
+ *   DESCRIPTION: Read the sizes of all photos and object images named in
+ *                the load_job array, creating photos and images without
+ *                pixel data.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in results of all jobs; prints time taken
+ */
+static void
+read_sizes ()
+{
+    struct timespec start;	/* start of reading */
+    int32_t         idx;	/* index over jobs  */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (idx = 0; N_LOAD_JOBS > idx; idx++) {
+	if (load_job[idx].is_photo) {
+	    load_job[idx].photo = read_photo_header (load_job[idx].filename);
+	} else {
+	    load_job[idx].image = read_obj_image_header (load_job[idx].filename);
+	}
+	load_job[idx].state = JOB_UNREAD;
+	load_job[idx].bytes = 0;
+    }
+    printf ("%8.2f ms  sizes of %d files\n", elapsed_msec (&start), 
+	    N_LOAD_JOBS);
+}
+
+
+/* 
+ * start_prefetch
+ *   DESCRIPTION: Read the photo and object images for the starting room,
+ *                then start the prefetch thread on the rooms near it.
+ *   INPUTS: start -- the starting room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reads files; creates a thread (if that fails, all
+ *                 other files are read on demand); prints time taken
+ */
+static void
+start_prefetch (room_t* start)
+{
+    struct timespec begin;	/* start of reading   */
+    object_t*       obj;	/* index over objects */
+    pthread_t       id;		/* prefetch thread    */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &begin);
+    (void)pthread_mutex_lock (&load_job_lock);
+    cur_room = start;
+    (void)pthread_mutex_unlock (&load_job_lock);
+    ensure_read (start->view_job);
+    for (obj = start->contents; NULL != obj; obj = obj->next) {
+        ensure_read (obj->img_job);
+    }
+    printf ("%8.2f ms  starting room %s\n", elapsed_msec (&begin), 
+	    start->name);
+
+    room_entered (start);
+    if (0 == pthread_create (&id, NULL, prefetch_thread, NULL)) {
+        (void)pthread_detach (id);
+    }
+}
+#endif /* PREFETCH_ROOMS */
+
+
 /* 
  * build_world
  *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
  *                reads in all image data (could be done lazily with 
- *                caching instead).
+ *                caching instead).  Image files are read in parallel
+ *                (see run_load_jobs).
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
@@ -864,16 +1929,27 @@ room_photo_width (const room_t* r)
 int32_t
 build_world ()
 {
-    int32_t idx;	/* index over data arrays   */
-    int32_t which;	/* id for current data item */
+    int32_t idx;		/* index over data arrays       */
+    int32_t which;		/* id for current data item     */
+    int8_t  swap_seen[N_SWAPS]; /* swap ids found in swap data  */
+    int32_t job;		/* index of job for current item */
+    const char* env;		/* PHOTO_BUDGET override        */
 
     /* Clear all accomplishment flags. */
     (void)memset (player_flags, 0, sizeof (player_flags));
 
+    /* Set the photo budget. */
+    photo_budget = (NULL != (env = getenv ("PHOTO_BUDGET")) ? 
+		    strtoul (env, NULL, 0) : PHOTO_BUDGET);
+
     /* Clear room data to enable sanity check for duplication. */
     (void)memset (room, 0, sizeof (room));
 
-    /* Loop over room data. */
+    /* 
+     * Check all ids and queue up the image files first, so that the files
+     * can be read in parallel.  The images are attached afterward, in the
+     * same order as the data arrays.
+     */
     for (idx = 0; N_ROOMS > idx; idx++) {
 	
 	/* Set the room id. */
@@ -888,28 +1964,14 @@ build_world ()
 	    fprintf (stderr, "Duplicate index %d in room data.\n", which);
 	    return 0;
 	}
-
-	/* Set up the room. */
         room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
-	if (NULL == room[which].view) {
-	    fprintf (stderr, "Can't read room photo %s.\n", 
-	    	     room_data[idx].filename);
-	    return 0;
-	}
-	room[which].contents = NULL;
-	room[which].left  = (R_NONE == room_data[idx].left ? NULL : 
-			     &room[room_data[idx].left]);
-	room[which].enter = (R_NONE == room_data[idx].enter ? NULL : 
-			     &room[room_data[idx].enter]);
-	room[which].right = (R_NONE == room_data[idx].right ? NULL : 
-			     &room[room_data[idx].right]);
+	load_job[idx].filename = room_data[idx].filename;
+	load_job[idx].is_photo = 1;
     }
 
     /* Clear object data to enable sanity check for duplication. */
     (void)memset (object, 0, sizeof (object));
 
-    /* Loop over object data. */
     for (idx = 0; N_OBJECTS > idx; idx++) {
 
 	/* Set the object id. */
@@ -924,10 +1986,75 @@ build_world ()
 	    fprintf (stderr, "Duplicate index %d in object data.\n", which);
 	    return 0;
 	}
+        object[which].name = obj_data[idx].name;
+	load_job[N_ROOMS + idx].filename = obj_data[idx].filename;
+	load_job[N_ROOMS + idx].is_photo = 0;
+    }
+
+    /* Clear swap photo data to enable sanity check for duplication. */
+    (void)memset (swap_photo, 0, sizeof (swap_photo));
+    (void)memset (swap_seen, 0, sizeof (swap_seen));
+
+    for (idx = 0; N_SWAPS > idx; idx++) {
+
+	/* Set the swap photo id. */
+	which = swap_data[idx].id;
+
+	/* Check for bad and duplicate ids. */
+	if (0 > which || N_SWAPS <= which) {
+	    fputs ("Bad index in swap data.\n", stderr);
+	    return 0;
+	}
+	if (swap_seen[which]) {
+	    fprintf (stderr, "Duplicate index %d in swap data.\n", which);
+	    return 0;
+	}
+	swap_seen[which] = 1;
+	load_job[N_ROOMS + N_OBJECTS + idx].filename = swap_data[idx].filename;
+	load_job[N_ROOMS + N_OBJECTS + idx].is_photo = 1;
+    }
+
+#if (1 == PREFETCH_ROOMS)
+    /* Read only the sizes of the image files for now. */
+    read_sizes ();
+#else /* !PREFETCH_ROOMS */
+    /* Read all of the image files. */
+    run_load_jobs ();
+#endif /* PREFETCH_ROOMS */
+
+    /* Loop over room data. */
+    for (idx = 0; N_ROOMS > idx; idx++) {
+	which = room_data[idx].id;
+
+	/* Set up the room. */
+	room[which].view = load_job[idx].photo;
+	room[which].view_job = &load_job[idx];
+	room[which].swap = -1;
+	if (NULL == room[which].view) {
+	    fprintf (stderr, "Can't read room photo %s.\n", 
+	    	     room_data[idx].filename);
+	    return 0;
+	}
+	room[which].contents = NULL;
+	room[which].left  = (R_NONE == room_data[idx].left ? NULL : 
+			     &room[room_data[idx].left]);
+	room[which].enter = (R_NONE == room_data[idx].enter ? NULL : 
+			     &room[room_data[idx].enter]);
+	room[which].right = (R_NONE == room_data[idx].right ? NULL : 
+			     &room[room_data[idx].right]);
+    }
+
+    /* 
+     * Loop over object data.  Objects are placed in data array order so
+     * that random placement does not depend on the order in which the
+     * images finished loading.
+     */
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+	which = obj_data[idx].id;
 
 	/* Set up the object. */
-        object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
+	object[which].img = load_job[N_ROOMS + idx].image;
+	object[which].img_job = &load_job[N_ROOMS + idx];
 	if (NULL == object[which].img) {
 	    fprintf (stderr, "Can't read object photo %s.\n", 
 	    	     obj_data[idx].filename);
@@ -949,27 +2076,15 @@ build_world ()
 	}
     }
 
-    /* Clear swap photo data to enable sanity check for duplication. */
-    (void)memset (swap_photo, 0, sizeof (swap_photo));
-
     /* Loop over swap photo data. */
     for (idx = 0; N_SWAPS > idx; idx++) {
-
-	/* Set the swap photo id. */
 	which = swap_data[idx].id;
+	job = N_ROOMS + N_OBJECTS + idx;
 
-	/* Check for bad and duplicate ids. */
-	if (0 > which || N_SWAPS <= which) {
-	    fputs ("Bad index in swap data.\n", stderr);
-	    return 0;
-	}
-	if (NULL != swap_photo[which]) {
-	    fprintf (stderr, "Duplicate index %d in swap data.\n", which);
-	    return 0;
-	}
-
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
+	/* Attach the swap photo. */
+	swap_photo[which] = load_job[job].photo;
+	swap_job[which] = &load_job[job];
+	room[swap_data[idx].room].swap = which;
 	if (NULL == swap_photo[which]) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     swap_data[idx].filename);
@@ -977,6 +2092,25 @@ build_world ()
 	}
     }
 
+#if (1 == PREFETCH_ROOMS)
+    /* Read the starting room and prefetch the rest in the background. */
+    start_prefetch (start_in_room ());
+#else /* !PREFETCH_ROOMS */
+    /* Count all photos against the budget, then trim to fit. */
+    (void)pthread_mutex_lock (&load_job_lock);
+    for (idx = 0; N_LOAD_JOBS > idx; idx++) {
+	if (load_job[idx].is_photo) {
+	    load_job[idx].bytes = 
+		    PHOTO_TILED_SIZE (photo_width (load_job[idx].photo), 
+				      photo_height (load_job[idx].photo));
+	    photo_bytes += load_job[idx].bytes;
+	}
+    }
+    cur_room = start_in_room ();
+    (void)make_room_for (0, UINT32_MAX);
+    (void)pthread_mutex_unlock (&load_job_lock);
+#endif /* PREFETCH_ROOMS */
+
     /* Everything worked! */
     return 1;
 }
@@ -998,6 +2132,164 @@ start_in_room ()
 }
 
 
+/* 
+ * room_entered
+ *   DESCRIPTION: Note that the player has entered a room.  The room's
+ *                photos are marked as shown (and can no longer be dropped
+ *                from memory; see PHOTO_BUDGET), and, if PREFETCH_ROOMS
+ *                is 1, the prefetch thread is told to read the photos and
+ *                object images of the rooms within PREFETCH_HOPS moves of
+ *                the room (counting the inventory as one move from 
+ *                anywhere), nearest first, then the swap photos and the
+ *                images of objects not in any room.
+ *   INPUTS: r -- the room that the player has entered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates photo residency counts; replaces the prefetch
+ *                 thread's list of jobs
+ */
+void
+room_entered (const room_t* r)
+{
+#if (1 == PREFETCH_ROOMS)
+    const room_t* near[N_ROOMS];    /* rooms to prefetch, nearest first */
+    int8_t        seen[N_ROOMS];    /* is room already in near?         */
+    int32_t       n_near;	    /* number of rooms in near          */
+    int32_t       first;	    /* first room at current distance   */
+    int32_t       last;		    /* end of rooms at current distance */
+    int32_t       hop;		    /* distance from r                  */
+    int32_t       idx;		    /* index over near/swaps/objects    */
+    const room_t* link[4];	    /* rooms one move from a room       */
+    int32_t       l;		    /* index over link                  */
+    object_t*     obj;		    /* index over room contents         */
+
+    /* Find the rooms within PREFETCH_HOPS moves of r. */
+    (void)memset (seen, 0, sizeof (seen));
+    near[0] = r;
+    seen[r - room] = 1;
+    n_near = 1;
+    for (hop = 0, first = 0; PREFETCH_HOPS > hop; hop++, first = last) {
+	for (last = n_near, idx = first; last > idx; idx++) {
+	    link[0] = near[idx]->left;
+	    link[1] = near[idx]->enter;
+	    link[2] = near[idx]->right;
+	    link[3] = &room[R_INVENTORY];
+	    for (l = 0; 4 > l; l++) {
+		if (NULL != link[l] && !seen[link[l] - room]) {
+		    seen[link[l] - room] = 1;
+		    near[n_near++] = link[l];
+		}
+	    }
+	}
+    }
+#endif /* PREFETCH_ROOMS */
+
+    (void)pthread_mutex_lock (&load_job_lock);
+
+    /* Count a hit if the room's photo is in memory. */
+    if (JOB_READ == r->view_job->state) {
+        photo_hits++;
+    } else {
+        photo_misses++;
+    }
+
+    /* 
+     * Pin the room's photos.  The clock advances by enough to order the
+     * prefetched photos (all treated as shown now) behind them.
+     */
+    cur_room = r;
+    show_clock += N_LOAD_JOBS + 1;
+
+    /* The room is drawn in full on entry. */
+    n_dirty = 0;
+    dirty_all = 0;
+    r->view_job->shown = show_clock;
+    if (-1 != r->swap) {
+        swap_job[r->swap]->shown = show_clock;
+    }
+
+#if (1 == PREFETCH_ROOMS)
+    /* Hand the jobs for nearby rooms and the others to the thread. */
+    n_prefetch = next_prefetch = 0;
+    for (idx = 0; n_near > idx; idx++) {
+	prefetch_list[n_prefetch++] = near[idx]->view_job;
+	for (obj = near[idx]->contents; NULL != obj; obj = obj->next) {
+	    prefetch_list[n_prefetch++] = obj->img_job;
+	}
+    }
+    for (idx = 0; N_SWAPS > idx; idx++) {
+	prefetch_list[n_prefetch++] = swap_job[idx];
+    }
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+	if (NULL == object[idx].loc) {
+	    prefetch_list[n_prefetch++] = object[idx].img_job;
+	}
+    }
+    for (idx = 1; n_prefetch > idx; idx++) {
+	if (show_clock > prefetch_list[idx]->shown) {
+	    prefetch_list[idx]->shown = show_clock - idx;
+	}
+    }
+    (void)pthread_cond_broadcast (&load_job_cv);
+#endif /* PREFETCH_ROOMS */
+
+    (void)pthread_mutex_unlock (&load_job_lock);
+}
+
+
+/* 
+ * room_photo_stats
+ *   DESCRIPTION: Get counts of photo residency events (see PHOTO_BUDGET).
+ *   INPUTS: none
+ *   OUTPUTS: *hits -- rooms entered with their photo in memory
+ *            *misses -- rooms entered with their photo not in memory
+ *            *evictions -- photos dropped from memory
+ *            *bytes -- bytes of photo pixel data now in memory
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+room_photo_stats (uint32_t* hits, uint32_t* misses, uint32_t* evictions,
+		  uint32_t* bytes)
+{
+    (void)pthread_mutex_lock (&load_job_lock);
+    *hits = photo_hits;
+    *misses = photo_misses;
+    *evictions = photo_evictions;
+    *bytes = photo_bytes;
+    (void)pthread_mutex_unlock (&load_job_lock);
+}
+
+
+/* 
+ * take_dirty_rects
+ *   DESCRIPTION: Get the parts of the current room's photo that have
+ *                changed since the room was entered or the parts were
+ *                last taken (see MAX_DIRTY_RECTS), and forget them.
+ *   INPUTS: max -- the number of rectangles that fit in rects
+ *   OUTPUTS: rects -- the changed rectangles, in photo coordinates
+ *   RETURN VALUE: the number of rectangles stored, or -1 if the whole
+ *                 room must be redrawn (the photo has been swapped, or
+ *                 there are more than max rectangles)
+ *   SIDE EFFECTS: clears the current room's dirty rectangles
+ */
+int32_t
+take_dirty_rects (dirty_rect_t* rects, int32_t max)
+{
+    int32_t n;	/* number of rectangles */
+
+    if (dirty_all || max < n_dirty) {
+        n = -1;
+    } else {
+        n = n_dirty;
+	(void)memcpy (rects, dirty_rect, n * sizeof (rects[0]));
+    }
+    n_dirty = 0;
+    dirty_all = 0;
+    return n;
+}
+
+
 /* 
  * player_has_board
  *   DESCRIPTION: Check whether the player has the board in inventory.
@@ -36,6 +36,8 @@
 #define WORLD_H
 
 
+#include <pthread.h>
+
 #include "types.h"
 
 
@@ -45,17 +47,84 @@ extern uint16_t obj_get_y (const object_t* obj);
 extern image_t* obj_image (const object_t* obj);
 extern object_t* obj_next (const object_t* obj);
 extern object_t* room_contents_iterate (const room_t* r);
+extern const obj_link_t* room_row_iterate (const room_t* r, int32_t y);
+extern const obj_link_t* room_col_iterate (const room_t* r, int32_t x);
+extern const obj_link_t* link_next (const obj_link_t* link);
+extern object_t* link_object (const obj_link_t* link);
 extern const char* room_name (const room_t* r);
 extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
 extern uint32_t room_photo_width (const room_t* r);
 
+/* Get a number that changes whenever the look of a room changes. */
+extern uint32_t room_version (const room_t* r);
+
+/* Get the rooms to the left, through the door, and to the right of r. */
+extern void room_neighbors (const room_t* r, const room_t* near[3]);
+
+/*
+ * Keep a room's photo in memory while a room other than the current one
+ * is drawn.  pin_room_photo returns 0 (and pins nothing) if the photo is
+ * not yet in memory.  The photo must not be swapped while pinned.
+ */
+extern int32_t pin_room_photo (const room_t* r);
+extern void unpin_room_photo (const room_t* r);
+
+/*
+ * Read the photo and object images of a room that are not yet in memory,
+ * releasing lock (which the caller holds, and which keeps the room from
+ * changing) while reading.  Returns 1 if the lock was released.
+ */
+extern int32_t read_room_images (const room_t* r, pthread_mutex_t* lock);
+
+/*
+ * Find the objects in a room whose images overlap a rectangle of its
+ * photo, in drawing order.  Stores the first max in found and returns
+ * the number overlapping.
+ */
+extern int32_t room_objects_in_rect (const room_t* r, int32_t x, int32_t y,
+				     int32_t w, int32_t h, object_t** found,
+				     int32_t max);
+
 /* Build the game world.  Returns 0 on failure, or 1 on success. */
 extern int32_t build_world (void);
 
 /* Get pointer to starting room for player. */
 extern room_t* start_in_room (void);
 
+/* 
+ * Note that the player has entered a room (keeps its photos in memory and
+ * starts reading photos for rooms nearby, if prefetching).
+ */
+extern void room_entered (const room_t* r);
+
+/* Get counts of photo residency hits, misses, and evictions (drops). */
+extern void room_photo_stats (uint32_t* hits, uint32_t* misses, 
+			      uint32_t* evictions, uint32_t* bytes);
+
+/*
+ * The parts of the current room's photo that objects have been placed
+ * in or taken from since the room was entered or the parts were last
+ * taken are kept, so that only those need be redrawn.  A change that
+ * overlaps or touches a recorded rectangle grows it, and once
+ * MAX_DIRTY_RECTS are recorded, the last grows to cover the rest.
+ */
+#define MAX_DIRTY_RECTS 8
+
+/* a rectangle of a room photo that must be redrawn */
+struct dirty_rect_t {
+    int32_t x, y;	/* upper left pixel */
+    int32_t w, h;	/* width and height */
+};
+
+/*
+ * Get (and forget) the rectangles of the current room's photo changed by
+ * objects placed or taken since the room was entered or the last call.
+ * Returns the number stored (at most max), or -1 if the whole room must
+ * be redrawn.
+ */
+extern int32_t take_dirty_rects (dirty_rect_t* rects, int32_t max);
+
 /*
  * checks for accelerator object ownership; these make horizontal (board)
  * and vertical (jetpack) pixel panning faster